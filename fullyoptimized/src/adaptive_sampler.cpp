@@ -0,0 +1,187 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <windows.h>
+
+#include "adaptive_sampler.h"
+#include "argparser.h"
+#include "mesh.h"
+#include "camera.h"
+#include "raytracer.h"
+#include "sampler.h"
+#include "utils.h"
+
+// no pixel gets more rays than this
+#define MAX_SAMPLES_PER_PIXEL 1024
+// the first round
+#define INITIAL_SAMPLES_PER_PIXEL 8
+
+// the luminance as displayed (clamped), so the very bright pixels of
+// the lights don't swamp the error estimate
+static double DisplayLuminance(const Vec3f &c) {
+  return 0.2126*my_min(1.0,c.r()) + 0.7152*my_min(1.0,c.g()) + 0.0722*my_min(1.0,c.b());
+}
+
+// ====================================================================
+// ====================================================================
+
+void AdaptiveSampler::TracePixel(int p, int num_samples) {
+  // each round continues the pixel's sequence where the last one
+  // stopped.  a stratified grid can't be extended like that, so there
+  // every round gets a grid of its own
+  Sampler sampler(args->sampler);
+  int first = count[p];
+  unsigned int seed = HashSeed(p);
+  if (sampler.getType() == SAMPLER_STRATIFIED) {
+    first = 0;
+    seed = HashSeed(p,count[p]);
+  }
+  int x = p % width;
+  int y = p / width;
+  // the samples of one pixel are about as coherent as rays get, so
+  // they are traced in packets
+  RayPacket packet;
+  Hit hits[RAY_PACKET_SIZE];
+  Vec3f colors[RAY_PACKET_SIZE];
+  double sx[RAY_PACKET_SIZE], sy[RAY_PACKET_SIZE];
+  for (int k = 0; k < num_samples; k += RAY_PACKET_SIZE) {
+    int n = my_min(RAY_PACKET_SIZE,num_samples-k);
+    for (int i = 0; i < n; i++) {
+      double u, v;
+      sampler.Get2D(first+k+i, first+num_samples, SAMPLE_PIXEL, seed, u, v);
+      sx[i] = (x - 0.5 + u) * pixel_size + offset_x;
+      sy[i] = (y - 0.5 + v) * pixel_size + offset_y;
+    }
+    mesh->camera->generateRays(sx, sy, n, packet.ox, packet.oy, packet.oz,
+                               packet.dx, packet.dy, packet.dz);
+    packet.setNumRays(n);
+    raytracer->TracePacket(packet,hits,colors,args->num_bounces);
+    for (int i = 0; i < n; i++) {
+      double l = DisplayLuminance(colors[i]);
+      sum[p] += colors[i];
+      sum_luminance[p] += l;
+      sum_luminance2[p] += l*l;
+    }
+  }
+  count[p] += num_samples;
+}
+
+// the standard error of the pixel's mean displayed luminance
+double AdaptiveSampler::Error(int p) const {
+  int n = count[p];
+  if (n < 2) return 1e30;
+  double mean = sum_luminance[p] / n;
+  double variance = my_max(0.0,(sum_luminance2[p] - n*mean*mean) / (n-1));
+  return sqrt(variance / n);
+}
+
+int AdaptiveSampler::numUnconverged() const {
+  int answer = 0;
+  for (int p = 0; p < width*height; p++) {
+    if (Error(p) > args->adaptive_error) answer++;
+  }
+  return answer;
+}
+
+// ====================================================================
+// THREADS
+// ====================================================================
+
+struct AdaptiveVars {
+  AdaptiveSampler *sampler;
+  const std::vector<int> *pixels;
+  const std::vector<int> *samples;
+  int first, step;
+};
+
+DWORD WINAPI AdaptivePixels(void *arg) {
+  AdaptiveVars *vars = (AdaptiveVars*)arg;
+  int n = vars->pixels->size();
+  for (int i = vars->first; i < n; i += vars->step) {
+    // (each pixel belongs to one thread, so its sums aren't shared)
+    vars->sampler->TracePixel((*vars->pixels)[i],(*vars->samples)[i]);
+  }
+  return 0;
+}
+
+void AdaptiveSampler::TraceRound(const std::vector<int> &pixels, const std::vector<int> &samples) {
+  int num_threads = my_max(1,my_min(args->num_threads,(int)pixels.size()));
+  std::vector<AdaptiveVars> vars(num_threads);
+  std::vector<HANDLE> threads(num_threads);
+  for (int t = 0; t < num_threads; t++) {
+    vars[t].sampler = this;
+    vars[t].pixels = &pixels;
+    vars[t].samples = &samples;
+    vars[t].first = t;
+    vars[t].step = num_threads;
+    threads[t] = CreateThread(NULL, 0, AdaptivePixels, &vars[t], 0, NULL);
+  }
+  WaitForMultipleObjects(num_threads, &threads[0], TRUE, INFINITE);
+  for (int t = 0; t < num_threads; t++) {
+    CloseHandle(threads[t]);
+  }
+  for (unsigned int i = 0; i < samples.size(); i++) rays_traced += samples[i];
+  num_rounds++;
+}
+
+// ====================================================================
+// ====================================================================
+
+// orders pixels by decreasing error
+struct ErrorGreater {
+  ErrorGreater(const std::vector<double> &e) : error(e) {}
+  bool operator()(int a, int b) const { return error[a] > error[b]; }
+  const std::vector<double> &error;
+};
+
+void AdaptiveSampler::Render() {
+  width = args->width;
+  height = args->height;
+  int max_d = my_max(width,height);
+  pixel_size = 1.0 / max_d;
+  offset_x = 0.5 - (width / 2.0) * pixel_size;
+  offset_y = 0.5 - (height / 2.0) * pixel_size;
+  int num_pixels = width*height;
+  sum.assign(num_pixels,Vec3f(0,0,0));
+  sum_luminance.assign(num_pixels,0);
+  sum_luminance2.assign(num_pixels,0);
+  count.assign(num_pixels,0);
+  rays_traced = 0;
+  num_rounds = 0;
+  long long budget = (long long)(args->adaptive_budget * num_pixels);
+
+  // the first round: a few rays everywhere to estimate the error
+  std::vector<int> pixels(num_pixels);
+  std::vector<int> samples(num_pixels,INITIAL_SAMPLES_PER_PIXEL);
+  for (int p = 0; p < num_pixels; p++) pixels[p] = p;
+  TraceRound(pixels,samples);
+
+  std::vector<double> error(num_pixels);
+  while (rays_traced < budget) {
+    // the unconverged pixels, worst first
+    pixels.clear();
+    for (int p = 0; p < num_pixels; p++) {
+      error[p] = Error(p);
+      if (error[p] > args->adaptive_error && count[p] < MAX_SAMPLES_PER_PIXEL)
+        pixels.push_back(p);
+    }
+    if (pixels.empty()) break;
+    std::sort(pixels.begin(),pixels.end(),ErrorGreater(error));
+    // double their samples while the budget lasts
+    samples.clear();
+    long long remaining = budget - rays_traced;
+    for (unsigned int i = 0; i < pixels.size(); i++) {
+      int more = count[pixels[i]];
+      if (more > remaining) {
+        if (remaining > 0) samples.push_back((int)remaining);
+        remaining = 0;
+        break;
+      }
+      samples.push_back(more);
+      remaining -= more;
+    }
+    pixels.resize(samples.size());
+    if (pixels.empty()) break;
+    TraceRound(pixels,samples);
+  }
+}
@@ -0,0 +1,80 @@
+#ifndef _ADAPTIVE_SAMPLER_H_
+#define _ADAPTIVE_SAMPLER_H_
+
+#include <vector>
+#include "vectors.h"
+
+class Mesh;
+class RayTracer;
+class ArgParser;
+
+// ====================================================================
+// ====================================================================
+// Renders a whole frame with a global ray budget.  Every pixel starts
+// with a few jittered rays, then in each round the pixels whose
+// estimated error (the standard error of the mean displayed luminance)
+// is still above the target get their sample count doubled, worst
+// first, until the error target is met everywhere or the budget runs
+// out.
+
+class AdaptiveSampler {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  AdaptiveSampler(Mesh *m, RayTracer *r, ArgParser *a) {
+    mesh = m;
+    raytracer = r;
+    args = a;
+    width = height = 0;
+    rays_traced = 0;
+    num_rounds = 0;
+  }
+
+  // trace the frame (uses args->num_threads threads)
+  void Render();
+
+  // =========
+  // ACCESSORS
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  Vec3f getColor(int x, int y) const {
+    int p = y*width+x;
+    return (count[p] > 0) ? sum[p] * (1.0/count[p]) : Vec3f(0,0,0); }
+  long long getRaysTraced() const { return rays_traced; }
+  int getNumRounds() const { return num_rounds; }
+  // the pixels still above the error target
+  int numUnconverged() const;
+
+  // called by the worker threads
+  void TracePixel(int p, int num_samples);
+
+private:
+
+  // HELPER FUNCTIONS
+  double Error(int p) const;
+  void TraceRound(const std::vector<int> &pixels, const std::vector<int> &samples);
+
+  // ==============
+  // REPRESENTATION
+  Mesh *mesh;
+  RayTracer *raytracer;
+  ArgParser *args;
+  int width, height;
+  // the image plane: pixel (x,y) is centered at (x*pixel_size +
+  // offset_x, y*pixel_size + offset_y) in camera coordinates
+  double pixel_size, offset_x, offset_y;
+  // running sums for each pixel
+  std::vector<Vec3f> sum;
+  std::vector<double> sum_luminance;
+  std::vector<double> sum_luminance2;
+  std::vector<int> count;
+  long long rays_traced;
+  int num_rounds;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
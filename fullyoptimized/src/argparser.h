@@ -11,6 +11,15 @@
 enum RENDER_MODE { RENDER_MATERIALS, RENDER_RADIANCE, RENDER_FORM_FACTORS, 
 		   RENDER_LIGHTS, RENDER_UNDISTRIBUTED, RENDER_ABSORBED };
 
+// RADIOSITY SOLVERS
+enum RADIOSITY_SOLVER { RADIOSITY_SHOOTING, RADIOSITY_JACOBI, RADIOSITY_GAUSS_SEIDEL };
+
+// FORM FACTOR ESTIMATORS
+enum FORM_FACTOR_METHOD { FORM_FACTOR_RAYCAST, FORM_FACTOR_HEMICUBE, FORM_FACTOR_ANALYTIC };
+
+// SAMPLE SEQUENCES (for the pixel, light & photon samples)
+enum SAMPLER_TYPE { SAMPLER_RANDOM, SAMPLER_STRATIFIED, SAMPLER_HALTON, SAMPLER_SOBOL };
+
 
 // ======================================================================
 // Class to collect all the high-level rendering parameters controlled
@@ -38,6 +47,46 @@ public:
       } else if (!strcmp(argv[i],"-num_form_factor_samples")) {
 	i++; assert (i < argc); 
 	num_form_factor_samples = atoi(argv[i]);
+      } else if (!strcmp(argv[i],"-form_factor_cache")) {
+	i++; assert (i < argc); 
+	form_factor_cache = argv[i];
+      } else if (!strcmp(argv[i],"-form_factor_method")) {
+	i++; assert (i < argc); 
+	if (!strcmp(argv[i],"raycast")) form_factor_method = FORM_FACTOR_RAYCAST;
+	else if (!strcmp(argv[i],"hemicube")) form_factor_method = FORM_FACTOR_HEMICUBE;
+	else if (!strcmp(argv[i],"analytic")) form_factor_method = FORM_FACTOR_ANALYTIC;
+	else Usage(argv[0]);
+      } else if (!strcmp(argv[i],"-hemicube_resolution")) {
+	i++; assert (i < argc); 
+	hemicube_resolution = atoi(argv[i]);
+	assert (hemicube_resolution >= 2);
+      } else if (!strcmp(argv[i],"-hierarchical_radiosity")) {
+	hierarchical_radiosity = true;
+      } else if (!strcmp(argv[i],"-hierarchical_epsilon")) {
+	i++; assert (i < argc); 
+	hierarchical_epsilon = atof(argv[i]);
+      } else if (!strcmp(argv[i],"-hierarchical_min_area")) {
+	i++; assert (i < argc); 
+	hierarchical_min_area = atof(argv[i]);
+      } else if (!strcmp(argv[i],"-adaptive_threshold")) {
+	i++; assert (i < argc); 
+	adaptive_threshold = atof(argv[i]);
+      } else if (!strcmp(argv[i],"-radiosity_batch")) {
+	i++; assert (i < argc); 
+	radiosity_batch = atoi(argv[i]);
+	assert (radiosity_batch > 0);
+      } else if (!strcmp(argv[i],"-radiosity_solver")) {
+	i++; assert (i < argc); 
+	if (!strcmp(argv[i],"shooting")) radiosity_solver = RADIOSITY_SHOOTING;
+	else if (!strcmp(argv[i],"jacobi")) radiosity_solver = RADIOSITY_JACOBI;
+	else if (!strcmp(argv[i],"gauss_seidel")) radiosity_solver = RADIOSITY_GAUSS_SEIDEL;
+	else Usage(argv[0]);
+      } else if (!strcmp(argv[i],"-overshoot")) {
+	i++; assert (i < argc); 
+	overshoot = atof(argv[i]);
+	assert (overshoot > 0 && overshoot < 2);
+      } else if (!strcmp(argv[i],"-ambient_correction")) {
+	ambient_correction = true;
       } else if (!strcmp(argv[i],"-num_threads")) {
     	i++; assert (i < argc);
     	num_threads = atoi(argv[i]);
@@ -53,6 +102,10 @@ public:
       } else if (!strcmp(argv[i],"-num_bounces")) {
 	i++; assert (i < argc); 
 	num_bounces = atoi(argv[i]);
+      } else if (!strcmp(argv[i],"-russian_roulette_depth")) {
+	i++; assert (i < argc); 
+	russian_roulette_depth = atoi(argv[i]);
+	assert (russian_roulette_depth >= 0);
       } else if (!strcmp(argv[i],"-num_shadow_samples")) {
 	i++; assert (i < argc); 
 	num_shadow_samples = atoi(argv[i]);
@@ -64,6 +117,13 @@ public:
 	i++; assert (i < argc); 
 	num_glossy_samples = atoi(argv[i]);
 	assert (num_glossy_samples > 0);
+      } else if (!strcmp(argv[i],"-sampler")) {
+	i++; assert (i < argc); 
+	if (!strcmp(argv[i],"random")) sampler = SAMPLER_RANDOM;
+	else if (!strcmp(argv[i],"stratified")) sampler = SAMPLER_STRATIFIED;
+	else if (!strcmp(argv[i],"halton")) sampler = SAMPLER_HALTON;
+	else if (!strcmp(argv[i],"sobol")) sampler = SAMPLER_SOBOL;
+	else Usage(argv[0]);
       } else if (!strcmp(argv[i],"-ambient_light")) {
 	i++; assert (i < argc);
 	double r = atof(argv[i]);
@@ -80,6 +140,31 @@ public:
 	num_photons_to_collect = atoi(argv[i]);
       } else if (!strcmp(argv[i],"-gather_indirect")) {
 	gather_indirect = true;
+      } else if (!strcmp(argv[i],"-radiosity_indirect")) {
+	radiosity_indirect = true;
+      } else if (!strcmp(argv[i],"-shadow_photons")) {
+	shadow_photons = true;
+      } else if (!strcmp(argv[i],"-adaptive_budget")) {
+	i++; assert (i < argc); 
+	adaptive_budget = atof(argv[i]);
+	assert (adaptive_budget >= 0);
+      } else if (!strcmp(argv[i],"-adaptive_error")) {
+	i++; assert (i < argc); 
+	adaptive_error = atof(argv[i]);
+	assert (adaptive_error > 0);
+      } else if (!strcmp(argv[i],"-light_bvh")) {
+	light_bvh = true;
+      } else if (!strcmp(argv[i],"-sample_lights")) {
+	i++; assert (i < argc); 
+	sample_lights = atoi(argv[i]);
+	assert (sample_lights >= 0);
+      } else if (!strcmp(argv[i],"-wavefront")) {
+	wavefront = true;
+      } else if (!strcmp(argv[i],"-denoise")) {
+	denoise = true;
+      } else if (!strcmp(argv[i],"-denoise_reference")) {
+	i++; assert (i < argc); 
+	denoise_reference = argv[i];
       } else {
 	printf ("whoops error with command line argument %d: '%s'\n",i,argv[i]);
         Usage(argv[0]);
@@ -95,16 +180,38 @@ public:
     std::cerr << "   options:\n";
     std::cerr << "     -size <width> <height>\n";
     std::cerr << "     -num_form_factor_samples <num_samples>\n";
+    std::cerr << "     -form_factor_cache <directory>\n";
+    std::cerr << "     -form_factor_method <raycast|hemicube|analytic>\n";
+    std::cerr << "     -hemicube_resolution <pixels>\n";
+    std::cerr << "     -hierarchical_radiosity\n";
+    std::cerr << "     -hierarchical_epsilon <BF_epsilon>\n";
+    std::cerr << "     -hierarchical_min_area <area>\n";
+    std::cerr << "     -adaptive_threshold <relative_radiance_difference>\n";
+    std::cerr << "     -radiosity_batch <num_shooters_per_iteration>\n";
+    std::cerr << "     -radiosity_solver <shooting|jacobi|gauss_seidel>\n";
+    std::cerr << "     -overshoot <relaxation_factor>\n";
+    std::cerr << "     -ambient_correction\n";
     std::cerr << "     -sphere_rasterization <horiz> <vert>\n";
     std::cerr << "     -cylinder_ring_rasterization <rasterization>\n";
     std::cerr << "     -num_bounces <num_bounces>\n";
+    std::cerr << "     -russian_roulette_depth <bounces>\n";
     std::cerr << "     -num_shadow_samples <num_samples>\n";
     std::cerr << "     -num_antialias_samples <num_samples>\n";
     std::cerr << "     -num_glossy_samples <num_samples>\n";
+    std::cerr << "     -sampler <random|stratified|halton|sobol>\n";
     std::cerr << "     -ambient_list <r> <g> <b>\n";
     std::cerr << "     -num_photons_to_shoot <num_photons\n";
     std::cerr << "     -num_photons_to_collect <num_photons\n";
     std::cerr << "     -gather_indirect\n";
+    std::cerr << "     -radiosity_indirect\n";
+    std::cerr << "     -shadow_photons\n";
+    std::cerr << "     -sample_lights <lights per hit>\n";
+    std::cerr << "     -light_bvh\n";
+    std::cerr << "     -adaptive_budget <average rays per pixel>\n";
+    std::cerr << "     -adaptive_error <relative error>\n";
+    std::cerr << "     -wavefront\n";
+    std::cerr << "     -denoise\n";
+    std::cerr << "     -denoise_reference <image.ppm>\n";
     exit(1);
   } 
   
@@ -121,15 +228,28 @@ public:
     interpolate = false;
     wireframe = false;
     num_form_factor_samples = 1;
+    form_factor_cache = NULL;
+    form_factor_method = FORM_FACTOR_RAYCAST;
+    hemicube_resolution = 64;
     sphere_horiz = 8;
     sphere_vert = 6;
     cylinder_ring_rasterization = 20; 
+    hierarchical_radiosity = false;
+    hierarchical_epsilon = 0.01;
+    hierarchical_min_area = 0;
+    adaptive_threshold = 0.2;
+    radiosity_batch = 1;
+    radiosity_solver = RADIOSITY_SHOOTING;
+    overshoot = 1;
+    ambient_correction = false;
 
     // RAYTRACING PARAMETERS
     num_bounces = 0;
+    russian_roulette_depth = 3;
     num_shadow_samples = 0;
     num_antialias_samples = 1;
     num_glossy_samples = 1;
+    sampler = SAMPLER_RANDOM;
     ambient_light = Vec3f(0.1,0.1,0.1);
     intersect_backfacing = false;
 
@@ -139,6 +259,15 @@ public:
     num_photons_to_shoot = 10000;
     num_photons_to_collect = 100;
     gather_indirect = false;
+    radiosity_indirect = false;
+    shadow_photons = false;
+    sample_lights = 0;
+    light_bvh = false;
+    adaptive_budget = 0;
+    adaptive_error = 0.01;
+    wavefront = false;
+    denoise = false;
+    denoise_reference = NULL;
 
     //threads
     num_threads=5;
@@ -160,15 +289,28 @@ public:
   bool interpolate;
   bool wireframe;
   int num_form_factor_samples;
+  char *form_factor_cache;  // directory for saved form factors (NULL = off)
+  enum FORM_FACTOR_METHOD form_factor_method;
+  int hemicube_resolution;
   int sphere_horiz;
   int sphere_vert;
   int cylinder_ring_rasterization;
+  bool hierarchical_radiosity;
+  double hierarchical_epsilon;
+  double hierarchical_min_area;
+  double adaptive_threshold;
+  int radiosity_batch;
+  enum RADIOSITY_SOLVER radiosity_solver;
+  double overshoot;  // > 1 over-relaxes the jacobi & gauss-seidel sweeps
+  bool ambient_correction;
 
   // RAYTRACING PARAMETERS
   int num_bounces;
+  int russian_roulette_depth;  // bounces traced before the reflected rays play russian roulette
   int num_shadow_samples;
   int num_antialias_samples;
   int num_glossy_samples;
+  enum SAMPLER_TYPE sampler;
   Vec3f ambient_light;
   bool intersect_backfacing;
   int num_threads;
@@ -179,6 +321,15 @@ public:
   bool render_photons;
   bool render_kdtree;
   bool gather_indirect;
+  bool radiosity_indirect;  // ray tracer takes its indirect light from radiosity
+  bool shadow_photons;      // skip shadow rays where the photons agree
+  int sample_lights;        // lights (picked by power) per hit, 0 = all
+  bool light_bvh;           // pick the lights through a light BVH instead
+  double adaptive_budget;   // rays per pixel for the adaptive sampler (0 = off)
+  double adaptive_error;    // its target relative error
+  bool wavefront;           // trace the frame stage by stage (sorted ray queues)
+  bool denoise;             // filter the traced frame, guided by the primary hits
+  char *denoise_reference;  // print the error of the frame before & after (NULL = off)
 
 };
 
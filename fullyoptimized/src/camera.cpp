@@ -18,10 +18,38 @@ Camera::Camera(const Vec3f &c, const Vec3f &poi, const Vec3f &u) {
 
 OrthographicCamera::OrthographicCamera(const Vec3f &c, const Vec3f &poi, const Vec3f &u, double s) : Camera(c,poi,u) {
   size = s;
+  UpdateFrame();
 }
 
 PerspectiveCamera::PerspectiveCamera(const Vec3f &c, const Vec3f &poi, const Vec3f &u, double a) : Camera(c,poi,u) {
   angle = a;
+  UpdateFrame();
+}
+
+// ====================================================================
+// ====================================================================
+// CAMERA FRAME
+
+void Camera::UpdateFrame() {
+  direction = point_of_interest - camera_position;
+  direction.Normalize();
+  Vec3f::Cross3(horizontal, direction, up);
+  horizontal.Normalize();
+  Vec3f::Cross3(screen_up, horizontal, direction);
+  UpdateScreen();
+}
+
+void OrthographicCamera::UpdateScreen() {
+  screen_x = horizontal * size;
+  screen_y = screen_up * size;
+  screen_corner = camera_position - 0.5*screen_x - 0.5*screen_y;
+}
+
+void PerspectiveCamera::UpdateScreen() {
+  double screenHeight = 2 * tan(angle/2.0);
+  screen_x = horizontal * screenHeight;
+  screen_y = screen_up * screenHeight;
+  screen_corner = direction - 0.5*screen_x - 0.5*screen_y;
 }
 
 // ====================================================================
@@ -79,6 +107,7 @@ void Camera::dollyCamera(double dist) {
   diff.Normalize();
   d *= pow(1.003,dist);
   camera_position = point_of_interest + diff * d;
+  UpdateFrame();
 }
 
 // ====================================================================
@@ -87,11 +116,13 @@ void Camera::dollyCamera(double dist) {
 
 void OrthographicCamera::zoomCamera(double factor) {
   size *= pow(1.005,factor);
+  UpdateFrame();
   glInit(width,height);
 }
 
 void PerspectiveCamera::zoomCamera(double dist) {
   angle *= pow(1.003,dist);
+  UpdateFrame();
   glInit(width,height);
 }
 
@@ -105,6 +136,7 @@ void Camera::truckCamera(double dx, double dy) {
   Vec3f translate = (d*0.0007)*(getHorizontal()*dx + getScreenUp()*dy);
   camera_position += translate;
   point_of_interest += translate;
+  UpdateFrame();
 }
 
 // ====================================================================
@@ -126,6 +158,7 @@ void Camera::rotateCamera(double rx, double ry) {
   rotMat *= Matrix::MakeAxisRotation(getHorizontal(), ry);
   rotMat *= Matrix::MakeTranslation(-point_of_interest);
   rotMat.Transform(camera_position);
+  UpdateFrame();
 }
 
 // ====================================================================
@@ -133,26 +166,56 @@ void Camera::rotateCamera(double rx, double ry) {
 // GENERATE RAY
 
 Ray OrthographicCamera::generateRay(double x, double y) {
-  Vec3f screenCenter = camera_position;
-  Vec3f xAxis = getHorizontal() * size; 
-  Vec3f yAxis = getScreenUp() * size; 
-  Vec3f lowerLeft = screenCenter - 0.5*xAxis - 0.5*yAxis;
-  Vec3f screenPoint = lowerLeft + x*xAxis + y*yAxis;
-  return Ray(screenPoint,getDirection());
+  Vec3f screenPoint = screen_corner + x*screen_x + y*screen_y;
+  return Ray(screenPoint,direction);
 }
 
 Ray PerspectiveCamera::generateRay(double x, double y) {
-  Vec3f screenCenter = camera_position + getDirection();
-  double screenHeight = 2 * tan(angle/2.0);
-  Vec3f xAxis = getHorizontal() * screenHeight;
-  Vec3f yAxis = getScreenUp() * screenHeight;
-  Vec3f lowerLeft = screenCenter - 0.5*xAxis - 0.5*yAxis;
-  Vec3f screenPoint = lowerLeft + x*xAxis + y*yAxis;
-  Vec3f dir = screenPoint - camera_position;
+  Vec3f dir = screen_corner + x*screen_x + y*screen_y;
   dir.Normalize();
   return Ray(camera_position,dir); 
 } 
 
+// the same for many rays at once.  the loops are plain arithmetic on
+// the component arrays, so the compiler can vectorize them
+
+void OrthographicCamera::generateRays(const double x[], const double y[], int n,
+                                      double ox[], double oy[], double oz[],
+                                      double dx[], double dy[], double dz[]) {
+  const double cx = screen_corner.x(), cy = screen_corner.y(), cz = screen_corner.z();
+  const double ux = screen_x.x(), uy = screen_x.y(), uz = screen_x.z();
+  const double vx = screen_y.x(), vy = screen_y.y(), vz = screen_y.z();
+  for (int i = 0; i < n; i++) {
+    ox[i] = cx + x[i]*ux + y[i]*vx;
+    oy[i] = cy + x[i]*uy + y[i]*vy;
+    oz[i] = cz + x[i]*uz + y[i]*vz;
+    dx[i] = direction.x();
+    dy[i] = direction.y();
+    dz[i] = direction.z();
+  }
+}
+
+void PerspectiveCamera::generateRays(const double x[], const double y[], int n,
+                                     double ox[], double oy[], double oz[],
+                                     double dx[], double dy[], double dz[]) {
+  const double cx = screen_corner.x(), cy = screen_corner.y(), cz = screen_corner.z();
+  const double ux = screen_x.x(), uy = screen_x.y(), uz = screen_x.z();
+  const double vx = screen_y.x(), vy = screen_y.y(), vz = screen_y.z();
+  for (int i = 0; i < n; i++) {
+    double a = cx + x[i]*ux + y[i]*vx;
+    double b = cy + x[i]*uy + y[i]*vy;
+    double c = cz + x[i]*uz + y[i]*vz;
+    // (never 0, the screen is in front of the camera)
+    double inv_length = 1 / sqrt(a*a + b*b + c*c);
+    ox[i] = camera_position.x();
+    oy[i] = camera_position.y();
+    oz[i] = camera_position.z();
+    dx[i] = a * inv_length;
+    dy[i] = b * inv_length;
+    dz[i] = c * inv_length;
+  }
+}
+
 // ====================================================================
 // ====================================================================
 
@@ -201,6 +264,7 @@ std::istream& operator>>(std::istream &istr, OrthographicCamera &c) {
   istr >> token; assert (token == "size");
   istr >> c.size; 
   istr >> token; assert (token == "}");
+  c.UpdateFrame();
   return istr;
 }    
 
@@ -216,6 +280,7 @@ std::istream& operator>>(std::istream &istr, PerspectiveCamera &c) {
   istr >> token; assert (token == "angle");
   istr >> c.angle; 
   istr >> token; assert (token == "}");
+  c.UpdateFrame();
   return istr;
 }
 
@@ -18,6 +18,11 @@ public:
 
   // RENDERING
   virtual Ray generateRay(double x, double y) = 0;
+  // the rays through the n screen points (x[i],y[i]), one array per
+  // component (e.g. straight into a RayPacket)
+  virtual void generateRays(const double x[], const double y[], int n,
+                            double ox[], double oy[], double oz[],
+                            double dx[], double dy[], double dz[]) = 0;
 
   // GL NAVIGATION
   virtual void glInit(int w, int h) = 0;
@@ -32,19 +37,13 @@ protected:
   Camera() { assert(0); } // don't use
 
   // HELPER FUNCTIONS
-  Vec3f getHorizontal() const {
-    Vec3f answer;
-    Vec3f::Cross3(answer, getDirection(), up);
-    answer.Normalize();
-    return answer; }
-  Vec3f getScreenUp() const {
-    Vec3f answer;
-    Vec3f::Cross3(answer, getHorizontal(), getDirection());
-    return answer; }
-  Vec3f getDirection() const {
-    Vec3f answer = point_of_interest - camera_position;
-    answer.Normalize();
-    return answer; }
+  const Vec3f& getHorizontal() const { return horizontal; }
+  const Vec3f& getScreenUp() const { return screen_up; }
+  const Vec3f& getDirection() const { return direction; }
+  // recompute the camera frame & the screen, call whenever the camera
+  // moves (or zooms)
+  void UpdateFrame();
+  virtual void UpdateScreen() = 0;
 
   // REPRESENTATION
   Vec3f point_of_interest;
@@ -52,6 +51,15 @@ protected:
   Vec3f up;
   int width;
   int height;
+  // the frame, cached since every ray needs it
+  Vec3f direction;
+  Vec3f horizontal;
+  Vec3f screen_up;
+  // the screen point at (x,y) is screen_corner + x*screen_x + y*screen_y
+  // (relative to the camera position for a perspective camera)
+  Vec3f screen_corner;
+  Vec3f screen_x;
+  Vec3f screen_y;
 };
 
 // ====================================================================
@@ -67,6 +75,9 @@ public:
 
   // RENDERING
   Ray generateRay(double x, double y);
+  void generateRays(const double x[], const double y[], int n,
+                    double ox[], double oy[], double oz[],
+                    double dx[], double dy[], double dz[]);
 
   // GL NAVIGATION
   void glInit(int w, int h);
@@ -76,6 +87,9 @@ public:
 
 private:
 
+  // HELPER FUNCTIONS
+  void UpdateScreen();
+
   // REPRESENTATION
   double size;
 };
@@ -93,6 +107,9 @@ public:
 
   // RENDERING
   Ray generateRay(double x, double y);
+  void generateRays(const double x[], const double y[], int n,
+                    double ox[], double oy[], double oz[],
+                    double dx[], double dy[], double dz[]);
 
   // GL NAVIGATION
   void glInit(int w, int h);
@@ -102,6 +119,9 @@ public:
   
 private:
 
+  // HELPER FUNCTIONS
+  void UpdateScreen();
+
   // REPRESENTATION
   double angle;
 };
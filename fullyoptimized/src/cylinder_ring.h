@@ -23,6 +23,10 @@ public:
 
   // for ray tracing
   bool intersect(const Ray &r, Hit &h) const;
+  void getBounds(Vec3f &minimum, Vec3f &maximum) const {
+    // the ring's axis is vertical
+    minimum = center - Vec3f(outer_radius,height/2.0,outer_radius);
+    maximum = center + Vec3f(outer_radius,height/2.0,outer_radius); }
 
   // for OpenGL rendering & radiosity
   void addRasterizedFaces(Mesh *m, ArgParser *args);
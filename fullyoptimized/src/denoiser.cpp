@@ -0,0 +1,215 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <windows.h>
+
+#include "denoiser.h"
+#include "argparser.h"
+#include "image.h"
+#include "utils.h"
+
+// the passes spread the taps 1, 2, 4, 8 & 16 pixels apart
+#define DENOISE_PASSES 5
+// the difference in each guide that cuts a tap's weight by e.  the
+// color tolerance shrinks with every pass, so the wide passes only
+// smooth what the narrow ones left flat
+#define DENOISE_SIGMA_COLOR 0.15f
+#define DENOISE_SIGMA_ALBEDO 0.1f
+#define DENOISE_SIGMA_NORMAL 0.3f
+#define DENOISE_SIGMA_DEPTH 0.02f
+// and the color tolerance of a mirror is this many times smaller
+#define REFLECTIVE_SHARPNESS 8
+
+// the B3 spline
+static const float kernel[5] = { 1/16.0f, 1/4.0f, 3/8.0f, 1/4.0f, 1/16.0f };
+
+// ====================================================================
+// ====================================================================
+
+void Denoiser::Initialize(int w, int h) {
+  width = w;
+  height = h;
+  for (int c = 0; c < 3; c++) {
+    noisy[c].assign(w*h,0);
+    color[c].assign(w*h,0);
+    scratch[c].assign(w*h,0);
+    albedo[c].assign(w*h,0);
+    normal[c].assign(w*h,0);
+  }
+  depth.assign(w*h,0);
+  color_weight.assign(w*h,1);
+}
+
+Vec3f Denoiser::getColor(int x, int y) const {
+  int p = y*width + x;
+  return Vec3f(color[0][p],color[1][p],color[2][p]);
+}
+
+Vec3f Denoiser::getNoisyColor(int x, int y) const {
+  int p = y*width + x;
+  return Vec3f(noisy[0][p],noisy[1][p],noisy[2][p]);
+}
+
+void Denoiser::setColor(int x, int y, const Vec3f &c) {
+  if (x < 0 || x >= width || y < 0 || y >= height) return;
+  int p = y*width + x;
+  for (int k = 0; k < 3; k++) {
+    noisy[k][p] = c[k];
+    color[k][p] = c[k];
+  }
+}
+
+void Denoiser::setFeatures(int x, int y, const Vec3f &a, const Vec3f &n, double d,
+                           double reflectance) {
+  if (x < 0 || x >= width || y < 0 || y >= height) return;
+  int p = y*width + x;
+  for (int k = 0; k < 3; k++) {
+    albedo[k][p] = a[k];
+    normal[k][p] = n[k];
+  }
+  depth[p] = d;
+  // (a mirror tolerates REFLECTIVE_SHARPNESS times less color difference)
+  float sharpness = 1 + (REFLECTIVE_SHARPNESS-1) * my_max(0.0f,my_min((float)reflectance,1.0f));
+  color_weight[p] = sharpness*sharpness;
+}
+
+// ====================================================================
+// ====================================================================
+
+void Denoiser::FilterRows(int pass, int first, int last) {
+  int step = 1 << pass;
+  float sigma_color = DENOISE_SIGMA_COLOR / step;
+  float inv_color = 1 / (sigma_color*sigma_color);
+  float inv_albedo = 1 / (DENOISE_SIGMA_ALBEDO*DENOISE_SIGMA_ALBEDO);
+  float inv_normal = 1 / (DENOISE_SIGMA_NORMAL*DENOISE_SIGMA_NORMAL);
+  float inv_depth = 1 / (DENOISE_SIGMA_DEPTH*DENOISE_SIGMA_DEPTH);
+  std::vector<float> sum_r(width), sum_g(width), sum_b(width), sum_w(width);
+  for (int y = first; y < last; y++) {
+    std::fill(sum_r.begin(),sum_r.end(),0.0f);
+    std::fill(sum_g.begin(),sum_g.end(),0.0f);
+    std::fill(sum_b.begin(),sum_b.end(),0.0f);
+    std::fill(sum_w.begin(),sum_w.end(),0.0f);
+    int p = y*width;
+    for (int ky = -2; ky <= 2; ky++) {
+      int qy = y + ky*step;
+      if (qy < 0 || qy >= height) continue;
+      for (int kx = -2; kx <= 2; kx++) {
+        int dx = kx*step;
+        float h = kernel[ky+2] * kernel[kx+2];
+        // the taps that land inside of the frame (the rest are left
+        // out, the sum of the weights makes up for them)
+        int x0 = my_max(0,-dx);
+        int x1 = my_min(width,width-dx);
+        if (x0 >= x1) continue;
+        // pixel p+x is the center, pixel q+x the tap
+        int q = qy*width + dx;
+        const float *r = &color[0][0], *g = &color[1][0], *b = &color[2][0];
+        const float *ar = &albedo[0][0], *ag = &albedo[1][0], *ab = &albedo[2][0];
+        const float *nx = &normal[0][0], *ny = &normal[1][0], *nz = &normal[2][0];
+        const float *z = &depth[0];
+        const float *cw = &color_weight[0];
+        for (int x = x0; x < x1; x++) {
+          // colors are compared as displayed (clamped), so the lights
+          // don't stand out from everything
+          float dr = my_min(r[p+x],1.0f) - my_min(r[q+x],1.0f);
+          float dg = my_min(g[p+x],1.0f) - my_min(g[q+x],1.0f);
+          float db = my_min(b[p+x],1.0f) - my_min(b[q+x],1.0f);
+          float dar = ar[p+x] - ar[q+x];
+          float dag = ag[p+x] - ag[q+x];
+          float dab = ab[p+x] - ab[q+x];
+          float dnx = nx[p+x] - nx[q+x];
+          float dny = ny[p+x] - ny[q+x];
+          float dnz = nz[p+x] - nz[q+x];
+          // relative to the distance, so far away surfaces blur as much
+          float dz = (z[p+x] - z[q+x]) / (z[p+x] + 0.001f);
+          float w = h * expf(-((dr*dr + dg*dg + db*db) * inv_color * cw[p+x] +
+                               (dar*dar + dag*dag + dab*dab) * inv_albedo +
+                               (dnx*dnx + dny*dny + dnz*dnz) * inv_normal +
+                               dz*dz * inv_depth));
+          sum_r[x] += w * r[q+x];
+          sum_g[x] += w * g[q+x];
+          sum_b[x] += w * b[q+x];
+          sum_w[x] += w;
+        }
+      }
+    }
+    // (the center tap is always in, so the sum is never 0)
+    for (int x = 0; x < width; x++) {
+      scratch[0][p+x] = sum_r[x] / sum_w[x];
+      scratch[1][p+x] = sum_g[x] / sum_w[x];
+      scratch[2][p+x] = sum_b[x] / sum_w[x];
+    }
+  }
+}
+
+// ====================================================================
+// THREADS
+// ====================================================================
+
+struct DenoiseVars {
+  Denoiser *denoiser;
+  int pass;
+  int first, last;
+};
+
+DWORD WINAPI DenoiseRows(void *arg) {
+  DenoiseVars *vars = (DenoiseVars*)arg;
+  vars->denoiser->FilterRows(vars->pass,vars->first,vars->last);
+  return 0;
+}
+
+void Denoiser::Filter() {
+  if (width == 0 || height == 0) return;
+  int num_threads = my_max(1,my_min(args->num_threads,height));
+  std::vector<DenoiseVars> vars(num_threads);
+  std::vector<HANDLE> threads(num_threads);
+  for (int pass = 0; pass < DENOISE_PASSES; pass++) {
+    // every pass reads the whole output of the last one, so the
+    // threads are joined in between
+    for (int t = 0; t < num_threads; t++) {
+      vars[t].denoiser = this;
+      vars[t].pass = pass;
+      vars[t].first = height * t / num_threads;
+      vars[t].last = height * (t+1) / num_threads;
+      threads[t] = CreateThread(NULL, 0, DenoiseRows, &vars[t], 0, NULL);
+    }
+    WaitForMultipleObjects(num_threads, &threads[0], TRUE, INFINITE);
+    for (int t = 0; t < num_threads; t++) {
+      CloseHandle(threads[t]);
+    }
+    for (int c = 0; c < 3; c++) color[c].swap(scratch[c]);
+  }
+}
+
+// ====================================================================
+// ====================================================================
+
+// the 8 bit value glColor3f would show for a linear color channel
+static int DisplayValue(double c) {
+  double v = linear_to_srgb(my_max(0.0,c));
+  return (int)(my_min(1.0,v) * 255 + 0.5);
+}
+
+double Denoiser::DisplayError(const Image &reference, bool filtered) const {
+  if (reference.Width() != width || reference.Height() != height) {
+    std::cerr << "ERROR: the reference image is " << reference.Width() << "x" << reference.Height()
+              << ", the frame is " << width << "x" << height << std::endl;
+    return -1;
+  }
+  double sum = 0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      Vec3f c = filtered ? getColor(x,y) : getNoisyColor(x,y);
+      const Color &r = reference.GetPixel(x,y);
+      double dr = (DisplayValue(c.r()) - r.r) / 255.0;
+      double dg = (DisplayValue(c.g()) - r.g) / 255.0;
+      double db = (DisplayValue(c.b()) - r.b) / 255.0;
+      sum += dr*dr + dg*dg + db*db;
+    }
+  }
+  return sqrt(sum / (3.0*width*height));
+}
+
+// ====================================================================
+// ====================================================================
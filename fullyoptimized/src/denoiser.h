@@ -0,0 +1,83 @@
+#ifndef _DENOISER_H_
+#define _DENOISER_H_
+
+#include <vector>
+#include "vectors.h"
+
+class ArgParser;
+class Image;
+
+// ====================================================================
+// ====================================================================
+// An edge-avoiding A-trous wavelet filter (Dammertz et al. 2010) for
+// frames traced with only a few samples per pixel.  Each pass blurs
+// with a 5x5 B3 spline whose taps are twice as far apart as in the
+// last pass, and every tap is weighted down by how different its
+// color, albedo, normal & depth are from the center pixel, so the
+// blur stays inside of surfaces and off of texture & shadow edges.
+//
+// The buffers are stored one plane per channel, and each pass walks
+// the rows tap by tap, so the inner loops run over contiguous floats.
+
+class Denoiser {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  Denoiser(ArgParser *a) { args = a; width = height = 0; }
+
+  // the frame size, clears all of the buffers
+  void Initialize(int w, int h);
+
+  // =========
+  // ACCESSORS
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  // the filtered color (after Filter)
+  Vec3f getColor(int x, int y) const;
+  // the color as traced
+  Vec3f getNoisyColor(int x, int y) const;
+  // the root mean square difference of the displayed (8 bit) colors
+  // from an image of the same size, in [0,1]
+  double DisplayError(const Image &reference, bool filtered) const;
+
+  // =========
+  // MODIFIERS
+  // (pixels outside of the frame are ignored)
+  void setColor(int x, int y, const Vec3f &color);
+  // what the ray through the pixel center hit: a normal of 0 & a depth
+  // of 0 for the background.  the reflectance is the largest channel
+  // of the reflective color; what a surface reflects isn't in the
+  // guides, so shiny pixels are blurred less
+  void setFeatures(int x, int y, const Vec3f &albedo, const Vec3f &normal, double depth,
+                   double reflectance);
+
+  // filter the frame (uses args->num_threads threads)
+  void Filter();
+  // one pass over the rows [first,last), called by the worker threads
+  void FilterRows(int pass, int first, int last);
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  ArgParser *args;
+  int width, height;
+  // the traced colors, the colors after the last pass & the output of
+  // the current pass
+  std::vector<float> noisy[3];
+  std::vector<float> color[3];
+  std::vector<float> scratch[3];
+  // the guides
+  std::vector<float> albedo[3];
+  std::vector<float> normal[3];
+  std::vector<float> depth;
+  // 1/sigma^2 of the color weight at each pixel
+  std::vector<float> color_weight;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -1,6 +1,7 @@
 #include "face.h"
 #include "matrix.h"
 #include "utils.h"
+#include "ray_packet.h"
 
 // =========================================================================
 // =========================================================================
@@ -22,15 +23,18 @@ double Face::getArea() const {
 // =========================================================================
 
 Vec3f Face::RandomPoint()  {
-  Vec3f a = (*this)[0]->get();
-  Vec3f b = (*this)[1]->get();
-  Vec3f c = (*this)[2]->get();
-  Vec3f d = (*this)[3]->get();
-
   WaitForSingleObject(this->ranLock,INFINITE);
   float s = this->mtrand.rand(); // random real in [0,1]
   float t = this->mtrand.rand(); // random real in [0,1]
   ReleaseMutex(this->ranLock);
+  return PointAt(s,t);
+}
+
+Vec3f Face::PointAt(double s, double t) const {
+  Vec3f a = (*this)[0]->get();
+  Vec3f b = (*this)[1]->get();
+  Vec3f c = (*this)[2]->get();
+  Vec3f d = (*this)[3]->get();
   Vec3f answer = s*t*a + s*(1-t)*b + (1-s)*t*d + (1-s)*(1-t)*c;
   return answer;
 }
@@ -93,6 +97,92 @@ bool Face::triangle_intersect(const Ray &r, Hit &h, Vertex *a, Vertex *b, Vertex
 }
 
 
+// ==========================================================================
+// the packet versions: the same tests as above, but each one is done
+// for all the rays of the packet before the next, in loops over the
+// rays without branches (so the compiler can vectorize them)
+
+// the 3x3 determinant, in the same order as Matrix::det3x3
+static inline double Det3x3(double a1, double a2, double a3,
+                            double b1, double b2, double b3,
+                            double c1, double c2, double c3) {
+  return a1 * (b2 * c3 - b3 * c2) - b1 * (a2 * c3 - a3 * c2) + c1 * (a2 * b3 - a3 * b2);
+}
+
+void Face::intersect(const RayPacket &packet, Hit hits[], bool intersect_backfacing) const {
+  int n = packet.numRays();
+  Vec3f normal = computeNormal();
+  double nx = normal.x(), ny = normal.y(), nz = normal.z();
+  double d = normal.Dot3((*this)[0]->get());
+
+  // the plane
+  double t[RAY_PACKET_SIZE];
+  bool candidate[RAY_PACKET_SIZE];
+  for (int i = 0; i < n; i++) {
+    double numer = d - (packet.ox[i]*nx + packet.oy[i]*ny + packet.oz[i]*nz);
+    double denom = packet.dx[i]*nx + packet.dy[i]*ny + packet.dz[i]*nz;
+    t[i] = (denom != 0) ? numer / denom : 0;
+    candidate[i] = denom != 0 && (intersect_backfacing || denom < 0) &&
+      t[i] > EPSILON && t[i] < hits[i].getT();
+  }
+
+  // the two triangles
+  Vertex *a = (*this)[0];
+  Vertex *b = (*this)[1];
+  Vertex *c = (*this)[2];
+  Vertex *dd = (*this)[3];
+  bool inside1[RAY_PACKET_SIZE], inside2[RAY_PACKET_SIZE];
+  double beta1[RAY_PACKET_SIZE], gamma1[RAY_PACKET_SIZE];
+  double beta2[RAY_PACKET_SIZE], gamma2[RAY_PACKET_SIZE];
+  triangle_intersect(packet,t,candidate,a,b,c,inside1,beta1,gamma1);
+  triangle_intersect(packet,t,candidate,a,c,dd,inside2,beta2,gamma2);
+
+  // store the hits (the first triangle wins, as in intersect)
+  for (int i = 0; i < n; i++) {
+    if (!candidate[i] || !(inside1[i] || inside2[i])) continue;
+    hits[i].set(t[i],this->getMaterial(),normal);
+    Vertex *v1 = inside1[i] ? b : c;
+    Vertex *v2 = inside1[i] ? c : dd;
+    double beta = inside1[i] ? beta1[i] : beta2[i];
+    double gamma = inside1[i] ? gamma1[i] : gamma2[i];
+    double alpha = 1 - beta - gamma;
+    double t_s = alpha * a->get_s() + beta * v1->get_s() + gamma * v2->get_s();
+    double t_t = alpha * a->get_t() + beta * v1->get_t() + gamma * v2->get_t();
+    hits[i].setTextureCoords(t_s,t_t);
+    assert (hits[i].getT() >= EPSILON);
+  }
+}
+
+void Face::triangle_intersect(const RayPacket &packet, const double t[], const bool candidate[],
+                              Vertex *a, Vertex *b, Vertex *c, bool inside[],
+                              double beta[], double gamma[]) const {
+  const Vec3f &pa = a->get();
+  const Vec3f &pb = b->get();
+  const Vec3f &pc = c->get();
+  double abx = pa.x()-pb.x(), aby = pa.y()-pb.y(), abz = pa.z()-pb.z();
+  double acx = pa.x()-pc.x(), acy = pa.y()-pc.y(), acz = pa.z()-pc.z();
+  int n = packet.numRays();
+  for (int i = 0; i < n; i++) {
+    double Rdx = packet.dx[i], Rdy = packet.dy[i], Rdz = packet.dz[i];
+    double aox = pa.x()-packet.ox[i], aoy = pa.y()-packet.oy[i], aoz = pa.z()-packet.oz[i];
+    double detA = Det3x3(abx,acx,Rdx,
+                         aby,acy,Rdy,
+                         abz,acz,Rdz);
+    bool solvable = fabs(detA) > 0.000001;
+    double denom = solvable ? detA : 1;
+    beta[i]  = Det3x3(aox,acx,Rdx,
+                      aoy,acy,Rdy,
+                      aoz,acz,Rdz) / denom;
+    gamma[i] = Det3x3(abx,aox,Rdx,
+                      aby,aoy,Rdy,
+                      abz,aoz,Rdz) / denom;
+    inside[i] = candidate[i] && solvable &&
+      beta[i] >= -0.00001 && beta[i] <= 1.00001 &&
+      gamma[i] >= -0.00001 && gamma[i] <= 1.00001 &&
+      beta[i] + gamma[i] <= 1.00001;
+  }
+}
+
 bool Face::plane_intersect(const Ray &r, Hit &h, bool intersect_backfacing) const {
 
   // insert the explicit equation for the ray into the implicit equation of the plane
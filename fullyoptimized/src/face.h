@@ -10,6 +10,7 @@
 #include "MersenneTwister.h"
 
 class Material;
+class RayPacket;
 
 // ==============================================================
 // Simple class to store quads for use in radiosity & raytracing.
@@ -23,6 +24,7 @@ public:
   Face(Material *m) {
     edge = NULL;
     material = m;
+    original = false;
     ranLock=CreateMutex(NULL,FALSE,NULL);}
 
   // =========
@@ -47,8 +49,13 @@ public:
                    (*this)[3]->get());
   }
   Material* getMaterial() const { return material; }
+  // one of the quads from the .obj file (kept for ray tracing after
+  // it has been subdivided)
+  bool isOriginal() const { return original; }
   double getArea() const;
   Vec3f RandomPoint() ;
+  // the point at (s,t) in [0,1]^2, with the same bilinear map as RandomPoint
+  Vec3f PointAt(double s, double t) const;
   Vec3f computeNormal() const;
 
   // =========
@@ -58,10 +65,13 @@ public:
     assert (e != NULL);
     edge = e;
   }
+  void setOriginal() { original = true; }
 
   // ==========
   // RAYTRACING
   bool intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
+  // the same, for all the rays of a packet (hits[i] goes with ray i)
+  void intersect(const RayPacket &packet, Hit hits[], bool intersect_backfacing) const;
 
   // =========
   // RADIOSITY
@@ -73,6 +83,9 @@ protected:
   // helper functions
   bool triangle_intersect(const Ray &r, Hit &h, Vertex *a, Vertex *b, Vertex *c, bool intersect_backfacing) const;
   bool plane_intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
+  void triangle_intersect(const RayPacket &packet, const double t[], const bool candidate[],
+                          Vertex *a, Vertex *b, Vertex *c, bool inside[],
+                          double beta[], double gamma[]) const;
 
   // don't use this constructor
   Face& operator= (const Face&) { assert(0); exit(0); }
@@ -86,6 +99,7 @@ protected:
   
   int radiosity_patch_index;  // an awkward pointer to this patch in the Radiosity patch array
   Material *material;
+  bool original;
 
   MTRand mtrand;
   HANDLE ranLock;
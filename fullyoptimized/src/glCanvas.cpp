@@ -6,10 +6,18 @@
 #include "raytracer.h"
 #include "photon_mapping.h"
 #include "mesh.h"
+#include "face.h"
 #include "raytree.h"
+#include "adaptive_sampler.h"
+#include "wavefront.h"
+#include "denoiser.h"
+#include "material.h"
+#include "image.h"
+#include "sampler.h"
 #include "utils.h"
 #include "MersenneTwister.h"
 #include <time.h>
+#include <algorithm>
 
 // ========================================================
 // static variables of GLCanvas class
@@ -44,6 +52,16 @@ HANDLE* GLCanvas::glLock=new HANDLE[1];
 HANDLE* GLCanvas::ranLock=new HANDLE[1];
 int GLCanvas::pixels=0;
 
+// the rows of horizontal edge samples between the strips of the last
+// ray tracing pass.  each strip traces the row along its top and
+// passes it to the strip above, which waits for ready[k] before it
+// reads row k
+struct EdgeRows {
+  int width;                  // samples per row
+  std::vector<Vec3f> samples; // row k at [k*width, (k+1)*width)
+  std::vector<HANDLE> ready;  // set once row k is traced
+};
+
 //Thread Edits
 typedef struct ThreadValues
 {
@@ -57,6 +75,8 @@ typedef struct ThreadValues
 	ArgParser* args;
 	Mesh* mesh;
 	RayTracer *raytracer;
+	Denoiser *denoiser;   // collects the last pass (NULL = off)
+	EdgeRows *edge_rows;  // shared by the strips of the last pass
 } tVals;
 Vec3f TraceRay(double i, double j,tVals* vars);
 bool globalIsPoint;
@@ -313,6 +333,7 @@ void GLCanvas::keyboard(unsigned char key, int x, int y) {
 	vars.args=args;
 	vars.mesh=mesh;
 	vars.raytracer=raytracer;
+    if (args->radiosity_indirect) radiosity->PrepareIndirect();
     TraceRay(i,j,&vars);
     RayTree::Deactivate();
     // redraw
@@ -359,8 +380,12 @@ void GLCanvas::keyboard(unsigned char key, int x, int y) {
     // RADIOSITY STUFF
   case ' ': 
     // a single step of radiosity
-    radiosity->Iterate();
-    radiosity->setupVBOs();
+    {
+      double residual = radiosity->Iterate();
+      std::cout << "radiosity iteration " << radiosity->numIterations()
+                << ": residual " << residual << "\n"; fflush(stdout);
+    }
+    radiosity->updateColorVBOs();
     glutPostRedisplay();
     break;
   case 'a': case 'A':
@@ -379,6 +404,43 @@ void GLCanvas::keyboard(unsigned char key, int x, int y) {
     radiosity->setupVBOs();
     glutPostRedisplay();
     break;
+  case 'd': case 'D': {
+    // subdivide only where the current solution changes quickly
+    // (large gradients & shadow boundaries)
+    std::vector<bool> refine;
+    radiosity->ComputeRefinementFlags(refine);
+    int num_requested = std::count(refine.begin(),refine.end(),true);
+    radiosity->Cleanup();
+    int num_split = radiosity->getMesh()->AdaptiveSubdivision(refine);
+    std::cout << " adaptive subdivision: split " << num_split << " of " << refine.size()
+              << " quads (" << num_split-num_requested << " to avoid T-junctions), "
+              << radiosity->getMesh()->numFaces() << " faces" << std::endl;
+    radiosity->Reset();
+    radiosity->setupVBOs();
+    glutPostRedisplay();
+    break; }
+  case 'e': case 'E': {
+    // switch the first light off (or back on) and let the solver carry
+    // on from the current solution
+    if (args->hierarchical_radiosity || radiosity->getMesh()->getLights().empty()) {
+      printf ("no light to switch (or the hierarchical solver, which can't update incrementally)\n");
+      break;
+    }
+    std::vector<int> patches;
+    radiosity->getLightPatches(0,patches);
+    bool on = false;
+    for (unsigned int k = 0; k < patches.size(); k++) {
+      if (radiosity->getPatchEmission(patches[k]).Length() > 0) on = true;
+    }
+    Vec3f emission(0,0,0);
+    if (!on) emission = radiosity->getMesh()->getLights()[0]->getMaterial()->getEmittedColor();
+    for (unsigned int k = 0; k < patches.size(); k++) {
+      radiosity->setPatchEmission(patches[k],emission);
+    }
+    printf ("light 0 (%d patches) switched %s\n", (int)patches.size(), on ? "off" : "on");
+    radiosity->updateColorVBOs();
+    glutPostRedisplay();
+    break; }
   case 'c': case 'C':
     // clear the radiosity solution
     radiosity->Reset();
@@ -409,7 +471,7 @@ void GLCanvas::keyboard(unsigned char key, int x, int y) {
   case 'i':  case 'I':
     // interpolate patch illumination values
     args->interpolate = !args->interpolate;
-    radiosity->setupVBOs();
+    radiosity->updateColorVBOs();
     glutPostRedisplay();
     break;
   case 'b':  case 'B':
@@ -432,38 +494,107 @@ void GLCanvas::keyboard(unsigned char key, int x, int y) {
 }
 
 
-// trace a ray through pixel (i,j) of the image and return the color
-Vec3f TraceRay(double i, double j,tVals* arg) {
-  // compute and set the pixel color
+// trace one ray through the image at (x,y), in pixel units
+Vec3f TraceSample(double x, double y, tVals* arg) {
+	Ray r = arg->mesh->camera->generateRay(x * pixelSize + widthConst, y * pixelSize + heightConst);
+	Hit hit;
+	Vec3f part = arg->raytracer->TraceRay(r, hit, arg->args->num_bounces);
+	// add that ray for visualization
+	RayTree::AddMainSegment(r, 0, hit.getT());
+	return part;
+}
+
+// the same for the nx x ny grid of samples at (x0+x, y0+y), traced in
+// 4x4 packets.  colors[y*nx+x] is the color of sample (x,y)
+#define RAY_PACKET_WIDTH 4
+
+void TraceSampleGrid(double x0, double y0, int nx, int ny, tVals* arg, Vec3f *colors) {
+  RayPacket packet;
+  Hit hits[RAY_PACKET_SIZE];
+  Vec3f packet_colors[RAY_PACKET_SIZE];
+  double sx[RAY_PACKET_SIZE], sy[RAY_PACKET_SIZE];
+  for (int by = 0; by < ny; by += RAY_PACKET_WIDTH) {
+    for (int bx = 0; bx < nx; bx += RAY_PACKET_WIDTH) {
+      int w = my_min(RAY_PACKET_WIDTH,nx-bx);
+      int h = my_min(RAY_PACKET_WIDTH,ny-by);
+      for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+          sx[y*w+x] = (x0 + bx + x) * pixelSize + widthConst;
+          sy[y*w+x] = (y0 + by + y) * pixelSize + heightConst;
+        }
+      }
+      arg->mesh->camera->generateRays(sx, sy, w*h, packet.ox, packet.oy, packet.oz,
+                                      packet.dx, packet.dy, packet.dz);
+      packet.setNumRays(w*h);
+      arg->raytracer->TracePacket(packet, hits, packet_colors, arg->args->num_bounces);
+      for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+          colors[(by+y)*nx + bx+x] = packet_colors[y*w+x];
+          // add that ray for visualization
+          RayTree::AddMainSegment(packet.getRay(y*w+x), 0, hits[y*w+x].getT());
+        }
+      }
+    }
+  }
+}
+
+// what the rays through the centers of the w x h pixels at (i,j) hit
+// first, as guides for the denoiser
+void TraceFeatures(int i, int j, int w, int h, tVals* arg) {
+  RayPacket packet;
+  Hit hits[RAY_PACKET_SIZE];
+  double sx[RAY_PACKET_SIZE], sy[RAY_PACKET_SIZE];
+  Vec3f background = arg->raytracer->BackgroundColor();
+  for (int by = 0; by < h; by += RAY_PACKET_WIDTH) {
+    for (int bx = 0; bx < w; bx += RAY_PACKET_WIDTH) {
+      int pw = my_min(RAY_PACKET_WIDTH,w-bx);
+      int ph = my_min(RAY_PACKET_WIDTH,h-by);
+      for (int y = 0; y < ph; y++) {
+        for (int x = 0; x < pw; x++) {
+          sx[y*pw+x] = (i + bx + x) * pixelSize + widthConst;
+          sy[y*pw+x] = (j + by + y) * pixelSize + heightConst;
+        }
+      }
+      arg->mesh->camera->generateRays(sx, sy, pw*ph, packet.ox, packet.oy, packet.oz,
+                                      packet.dx, packet.dy, packet.dz);
+      packet.setNumRays(pw*ph);
+      // only the first hits are needed, nothing is shaded
+      arg->raytracer->CastPacket(packet, hits);
+      for (int k = 0; k < pw*ph; k++) {
+        int px = i + bx + k % pw;
+        int py = j + by + k / pw;
+        Material *m = hits[k].getMaterial();
+        if (m == NULL) {
+          arg->denoiser->setFeatures(px, py, background, Vec3f(0,0,0), 0, 0);
+          continue;
+        }
+        // the lights get their (clamped) color, so they stay sharp
+        Vec3f albedo = m->getDiffuseColor(hits[k].get_s(), hits[k].get_t());
+        const Vec3f &emitted = m->getEmittedColor();
+        if (emitted.Length() > 0.001)
+          albedo = Vec3f(my_min(emitted.r(),1.0),my_min(emitted.g(),1.0),my_min(emitted.b(),1.0));
+        const Vec3f &reflective = m->getReflectiveColor();
+        double reflectance = my_max(reflective.r(),my_max(reflective.g(),reflective.b()));
+        arg->denoiser->setFeatures(px, py, albedo, hits[k].getNormal(), hits[k].getT(), reflectance);
+      }
+    }
+  }
+}
+
+// the color of pixel (i,j) from the samples at the midpoints of its 4
+// edges, with extra random rays if they disagree
+Vec3f ResolvePixel(double i, double j, const Vec3f colors[4], tVals* arg) {
   Vec3f color;
   double x0 = i * pixelSize+ widthConst;
   double y0 = j * pixelSize + heightConst;
   x0 -= pixelSize / 2;
   y0 -= pixelSize / 2;
-  std::vector<Vec3f> colors;
   Vec3f part;
-
-  for (int m = 0; m < 3; m++)
+  for (int m = 0; m < 4; m++)
 	{
-		for (int n = 0; n < 3; n++)
-		{
-			if (m==n)
-				continue;
-			if (m!=1&&n!=1)
-				continue;
-			double x = x0 + m * pixelSize/2;
-			double y = y0 + n * pixelSize/2;
-
-			Ray r = arg->mesh->camera->generateRay(x, y);
-			Hit hit;
-			part = arg->raytracer->TraceRay(r, hit, arg->args->num_bounces);
-			colors.push_back(part);
-			part /= 4;
-			color += part;
-
-			// add that ray for visualization
-			RayTree::AddMainSegment(r, 0, hit.getT());
-		}
+		part = colors[m];
+		part /= 4;
+		color += part;
 	}
 	float VarianceLimit = .05;
 	bool withinBounds = true;
@@ -485,12 +616,15 @@ Vec3f TraceRay(double i, double j,tVals* arg) {
 	if (!withinBounds)
 	{
 		color=Vec3f(0,0,0);
+		// the jitter comes from the pixel's own scrambled sequence
+		Sampler sampler(arg->args->sampler);
+		unsigned int seed = HashSeed((int)i, (int)j);
 		for (int i = 0; i < arg->args->num_antialias_samples; i++)
 		{
-			WaitForSingleObject(*arg->ranLock,INFINITE);
-			double x = x0 + GLOBAL_mtrand.rand()* pixelSize;
-			double y = y0 + GLOBAL_mtrand.rand()* pixelSize;
-			ReleaseMutex(*arg->ranLock);
+			double u, v;
+			sampler.Get2D(i, arg->args->num_antialias_samples, SAMPLE_PIXEL, seed, u, v);
+			double x = x0 + u * pixelSize;
+			double y = y0 + v * pixelSize;
 			Ray r = arg->mesh->camera->generateRay(x, y);
 			Hit hit;
 			part = arg->raytracer->TraceRay(r, hit, arg->args->num_bounces);
@@ -506,7 +640,53 @@ Vec3f TraceRay(double i, double j,tVals* arg) {
 	return color;
 }
 
+// trace a ray through pixel (i,j) of the image and return the color
+Vec3f TraceRay(double i, double j,tVals* arg) {
+  // left, bottom, top & right edge midpoints
+  Vec3f colors[4];
+  colors[0] = TraceSample(i - 0.5, j, arg);
+  colors[1] = TraceSample(i, j - 0.5, arg);
+  colors[2] = TraceSample(i, j + 0.5, arg);
+  colors[3] = TraceSample(i + 0.5, j, arg);
+  return ResolvePixel(i, j, colors, arg);
+}
 
+// the same for strip number k of the last pass: the w x h pixels at
+// (i,j), all the way across the image.  each edge midpoint is shared
+// by two pixels, so every sample is traced once: the vertical edges
+// and the rows inside of & along the top of the strip here, the row
+// along the bottom by the strip below (only the first strip traces
+// its own)
+void TraceStrip(int k, int i, int j, int w, int h, tVals* arg, Vec3f *strip_colors) {
+  EdgeRows *rows = arg->edge_rows;
+  assert (rows != NULL && rows->width == w);
+  // the vertical edges: w+1 per row.  the horizontal edges: w per
+  // row boundary, h+1 of them
+  std::vector<Vec3f> vertical((w+1)*h);
+  std::vector<Vec3f> horizontal(w*(h+1));
+  TraceSampleGrid(i - 0.5, j, w + 1, h, arg, &vertical[0]);
+  TraceSampleGrid(i, j + 0.5, w, h, arg, &horizontal[w]);
+  std::copy(horizontal.begin() + h*w, horizontal.end(), rows->samples.begin() + (k+1)*w);
+  SetEvent(rows->ready[k+1]);
+  if (k == 0) {
+    TraceSampleGrid(i, j - 0.5, w, 1, arg, &horizontal[0]);
+  } else {
+    // (the strip below was claimed first, and traces its top row
+    // before it waits for anything, so this can't deadlock)
+    WaitForSingleObject(rows->ready[k], INFINITE);
+    std::copy(rows->samples.begin() + k*w, rows->samples.begin() + (k+1)*w, horizontal.begin());
+  }
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      Vec3f colors[4];
+      colors[0] = vertical[y*(w+1)+x];
+      colors[1] = horizontal[y*w+x];
+      colors[2] = horizontal[(y+1)*w+x];
+      colors[3] = vertical[y*(w+1)+x+1];
+      strip_colors[y*w+x] = ResolvePixel(i + x, j + y, colors, arg);
+    }
+  }
+}
 
 // Scan through the image from the lower left corner across each row
 // and then up to the top right.  Initially the image is sampled very
@@ -516,20 +696,30 @@ Vec3f TraceRay(double i, double j,tVals* arg) {
 {
 
 }*/
+// the last pass (every pixel) is traced in strips this many rows high
+// that span the image, so the edge samples neighboring pixels share
+// are only traced once
+#define RAY_STRIP_HEIGHT 8
+
 DWORD WINAPI DrawPixel(void * arg)
 {
 	tVals* vars = (tVals*)arg;
 	int i=0;
+	int strip_width = vars->args->width + 1;
+	std::vector<Vec3f> tile_colors(RAY_STRIP_HEIGHT*strip_width);
 	while(true)
 	{
 		i++;
-	  double rayx,rayy;
+	  int rayx,rayy;
 	  int tempSkip;
 	  WaitForSingleObject(*(vars->rayLock),INFINITE);
 
+	  // how far apart the claimed pixels (or strips) are
+	  int step_x = ((*vars->raytracing_skip) == 1) ? strip_width : (*vars->raytracing_skip);
+	  int step_y = ((*vars->raytracing_skip) == 1) ? RAY_STRIP_HEIGHT : (*vars->raytracing_skip);
 	  if ((*vars->raytracing_x) > vars->args->width) {
 		  (*vars->raytracing_x) = (*vars->raytracing_skip)/2;
-		  (*vars->raytracing_y) += (*vars->raytracing_skip);
+		  (*vars->raytracing_y) += step_y;
 	  }
 	  if ((*vars->raytracing_y) > vars->args->height) {
 		if ((*vars->raytracing_skip) == 1) return 0;
@@ -538,47 +728,92 @@ DWORD WINAPI DrawPixel(void * arg)
 		assert (*(vars->raytracing_skip) >= 1);
 		(*vars->raytracing_x) = (*vars->raytracing_skip)/2;
 		(*vars->raytracing_y) = (*vars->raytracing_skip)/2;
-
+		step_x = ((*vars->raytracing_skip) == 1) ? strip_width : (*vars->raytracing_skip);
 	  }
 	  rayx=*(vars->raytracing_x);
 	  rayy=*(vars->raytracing_y);
 	  tempSkip=(*vars->raytracing_skip);
-	  (*vars->raytracing_x) += *(vars->raytracing_skip);
-	  (*vars->pixels)+=1;
+	  (*vars->raytracing_x) += step_x;
+	  // a strip on the last pass, otherwise a single pixel
+	  int w = 1, h = 1;
+	  if (tempSkip == 1) {
+		  w = strip_width;
+		  h = my_min(RAY_STRIP_HEIGHT, vars->args->height - rayy + 1);
+	  }
+	  (*vars->pixels)+=w*h;
 
 
 	  ReleaseMutex(*(vars->rayLock));
 
 	  // compute the color and position of intersection
-	  Vec3f color= TraceRay(rayx, rayy,vars);
-	  double r = linear_to_srgb(color.x());
-	  double g = linear_to_srgb(color.y());
-	  double b = linear_to_srgb(color.z());
-	  double x = 2 * (rayx/double(vars->args->width)) - 1;
-	  double y = 2 * (rayy/double(vars->args->height)) - 1;
-	  //std::cout<<r<<g<<b<<std::endl;
-	  WaitForSingleObject(*(vars->glLock),INFINITE);
-	  globalR=r;globalG=g;globalB=b;
-	  globalX=x;globalY=y;
-	  globalSkip=tempSkip;
-	  //if ((*vars->pixels)<10000)
-	  globalIsPoint=true;
-	  while (globalIsPoint);
-	  ReleaseMutex(*(vars->glLock));
+	  if (tempSkip == 1)
+		  TraceStrip(rayy / RAY_STRIP_HEIGHT, rayx, rayy, w, h, vars, &tile_colors[0]);
+	  else
+		  tile_colors[0] = TraceRay(rayx, rayy, vars);
+	  if (tempSkip == 1 && vars->denoiser != NULL)
+		  TraceFeatures(rayx, rayy, w, h, vars);
+	  for (int k = 0; k < w*h; k++) {
+		  Vec3f color = tile_colors[k];
+		  double px = rayx + k % w;
+		  double py = rayy + k / w;
+		  if (tempSkip == 1 && vars->denoiser != NULL)
+			  vars->denoiser->setColor(rayx + k % w, rayy + k / w, color);
+		  double r = linear_to_srgb(color.x());
+		  double g = linear_to_srgb(color.y());
+		  double b = linear_to_srgb(color.z());
+		  double x = 2 * (px/double(vars->args->width)) - 1;
+		  double y = 2 * (py/double(vars->args->height)) - 1;
+		  //std::cout<<r<<g<<b<<std::endl;
+		  WaitForSingleObject(*(vars->glLock),INFINITE);
+		  globalR=r;globalG=g;globalB=b;
+		  globalX=x;globalY=y;
+		  globalSkip=tempSkip;
+		  //if ((*vars->pixels)<10000)
+		  globalIsPoint=true;
+		  while (globalIsPoint);
+		  ReleaseMutex(*(vars->glLock));
+	  }
 	}
 	std::cout<<"ENDED"<<std::endl;
 	return 1;
 }
 
+// draws a finished frame (from the adaptive sampler or the wavefront
+// renderer) one point per pixel
+template <class Renderer> void DrawImage(const Renderer &renderer) {
+  glPointSize(1);
+  glBegin(GL_POINTS);
+  for (int y = 0; y < renderer.getHeight(); y++) {
+    for (int x = 0; x < renderer.getWidth(); x++) {
+      Vec3f color = renderer.getColor(x,y);
+      glColor3f(linear_to_srgb(color.x()),linear_to_srgb(color.y()),linear_to_srgb(color.z()));
+      glVertex3f(2*(x/double(renderer.getWidth()))-1,2*(y/double(renderer.getHeight()))-1,-1);
+    }
+  }
+  glEnd();
+  glFlush();
+}
+
 
 void GLCanvas::idle() {
   if (args->radiosity_animation) {
     double undistributed = radiosity->Iterate();
-    if (undistributed < 0.001) {
+    // every sweep of the gathering solvers is reported, so they can be
+    // compared.  progressive shooting only about once a second (a
+    // shooting step can take well under a millisecond)
+    static clock_t last_report = 0;
+    bool converged = (undistributed < 0.001);
+    if (converged || args->radiosity_solver != RADIOSITY_SHOOTING || args->hierarchical_radiosity ||
+        clock() - last_report >= CLOCKS_PER_SEC) {
+      last_report = clock();
+      std::cout << "radiosity iteration " << radiosity->numIterations()
+                << ": residual " << undistributed << "\n"; fflush(stdout);
+    }
+    if (converged) {
       args->radiosity_animation = false;
       std::cout << "undistributed < 0.001, animation stopped\n"; fflush(stdout);
     }
-    radiosity->setupVBOs();
+    radiosity->updateColorVBOs();
     glutPostRedisplay();
   }
   if (args->raytracing_animation) {
@@ -617,6 +852,50 @@ void GLCanvas::idle() {
 	vars.args=args;
 	vars.mesh=mesh;
 	vars.raytracer=raytracer;
+    if (args->radiosity_indirect) radiosity->PrepareIndirect();
+    if (args->adaptive_budget > 0) {
+      // spend the ray budget where the error is, then draw the frame
+      AdaptiveSampler sampler(mesh,raytracer,args);
+      sampler.Render();
+      glEnd();
+      DrawImage(sampler);
+      args->raytracing_animation = false;
+      t = clock() - t;
+      std::cout << "Adaptive sampling: " << sampler.getRaysTraced() << " rays in "
+                << sampler.getNumRounds() << " rounds, " << sampler.numUnconverged()
+                << " pixels above the error target, "
+                << (((float)t) / CLOCKS_PER_SEC) << " seconds" << std::endl;
+      return;
+    }
+    if (args->wavefront) {
+      // every stage runs over the whole frame, so there is nothing to
+      // draw until the end
+      WavefrontRenderer renderer(mesh,raytracer,args);
+      renderer.Render();
+      glEnd();
+      DrawImage(renderer);
+      args->raytracing_animation = false;
+      t = clock() - t;
+      std::cout << "Wavefront: " << renderer.getRaysTraced() << " rays & "
+                << renderer.getShadowRaysTraced() << " shadow rays, "
+                << (((float)t) / CLOCKS_PER_SEC) << " seconds" << std::endl;
+      return;
+    }
+    // the denoiser gets the colors of the last pass as they are traced
+    Denoiser denoiser(args);
+    if (args->denoise) {
+      denoiser.Initialize(args->width, args->height);
+      vars.denoiser = &denoiser;
+    }
+    // one row of edge samples below & above each strip of the last pass
+    EdgeRows edge_rows;
+    edge_rows.width = args->width + 1;
+    int num_edge_rows = args->height / RAY_STRIP_HEIGHT + 2;
+    edge_rows.samples.resize(num_edge_rows * edge_rows.width);
+    edge_rows.ready.resize(num_edge_rows);
+    for (int k = 0; k < num_edge_rows; k++)
+      edge_rows.ready[k] = CreateEvent(NULL, TRUE, FALSE, NULL);
+    vars.edge_rows = &edge_rows;
     for (int i=0;i<args->num_threads;i++)
     {
     	TerminateThread(threads[i],0);
@@ -658,11 +937,26 @@ void GLCanvas::idle() {
     	}
     }
 	args->raytracing_animation = false;
+    for (int k = 0; k < num_edge_rows; k++)
+      CloseHandle(edge_rows.ready[k]);
     glEnd();
     glFlush();
     t = clock() - t;
     //double second = difftime(end,start);
     std::cout<<"Ray Tracing Completed in "<<(((float)t) / CLOCKS_PER_SEC)<<" seconds"<<std::endl;
+    if (args->denoise) {
+      t = clock();
+      denoiser.Filter();
+      DrawImage(denoiser);
+      t = clock() - t;
+      std::cout << "Denoising: " << (((float)t) / CLOCKS_PER_SEC) << " seconds" << std::endl;
+      if (args->denoise_reference != NULL) {
+        Image reference(args->denoise_reference);
+        std::cout << "Error against " << args->denoise_reference << ": "
+                  << denoiser.DisplayError(reference,false) << " traced, "
+                  << denoiser.DisplayError(reference,true) << " denoised" << std::endl;
+      }
+    }
   }
 }
 
@@ -0,0 +1,187 @@
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+
+#include "hemicube.h"
+#include "utils.h"
+
+// ====================================================================
+// CONSTRUCTOR
+// ====================================================================
+
+Hemicube::Hemicube(int _resolution) {
+  // the side faces are half as tall as they are wide
+  resolution = _resolution + (_resolution % 2);
+  assert (resolution >= 2);
+  depth.resize(resolution*resolution);
+  ids.resize(resolution*resolution);
+
+  // delta form factors of the pixels, on a cube with half-width 1
+  // top:  dA / (pi (x^2+y^2+1)^2)
+  // side: y dA / (pi (x^2+y^2+1)^2)   (y measured along the normal)
+  double pixel = 2.0 / resolution;
+  double dA = pixel * pixel;
+  delta_top.resize(resolution*resolution);
+  delta_side.resize(resolution*resolution/2);
+  for (int py = 0; py < resolution; py++) {
+    for (int px = 0; px < resolution; px++) {
+      double x = -1 + (px+0.5)*pixel;
+      double y = -1 + (py+0.5)*pixel;
+      double r2 = x*x + y*y + 1;
+      delta_top[py*resolution+px] = dA / (M_PI * r2 * r2);
+      if (py < resolution/2) {
+        y = (py+0.5)*pixel;
+        r2 = x*x + y*y + 1;
+        delta_side[py*resolution+px] = y * dA / (M_PI * r2 * r2);
+      }
+    }
+  }
+}
+
+// ====================================================================
+// ====================================================================
+
+void Hemicube::ComputeRow(const std::vector<HemicubePatch> &patches, int i, double *row) {
+  int n = patches.size();
+  for (int j = 0; j < n; j++) row[j] = 0;
+
+  const HemicubePatch &p = patches[i];
+  Vec3f normal = p.normal;
+  normal.Normalize();
+  // a frame on the patch
+  Vec3f right = p.verts[1] - p.verts[0];
+  right -= right.Dot3(normal) * normal;
+  right.Normalize();
+  Vec3f up;
+  Vec3f::Cross3(up,normal,right);
+  // lift the eye just off the patch so its coplanar neighbors are
+  // below the horizon
+  Vec3f center = p.centroid + 0.0001 * (p.verts[2]-p.verts[0]).Length() * normal;
+
+  // the top, then the four sides (the normal is "up" on the sides)
+  RenderFace(patches,i,row,center,right,up,normal,true);
+  RenderFace(patches,i,row,center,up,normal,right,false);
+  RenderFace(patches,i,row,center,up,normal,-1*right,false);
+  RenderFace(patches,i,row,center,right,normal,up,false);
+  RenderFace(patches,i,row,center,right,normal,-1*up,false);
+}
+
+void Hemicube::RenderFace(const std::vector<HemicubePatch> &patches, int i, double *row, const Vec3f &center,
+                          const Vec3f &right, const Vec3f &up, const Vec3f &forward, bool top) {
+  int rows = top ? resolution : resolution/2;
+  int num_pixels = rows*resolution;
+  for (int k = 0; k < num_pixels; k++) {
+    depth[k] = DBL_MAX;
+    ids[k] = -1;
+  }
+  int n = patches.size();
+  for (int j = 0; j < n; j++) {
+    if (j == i) continue;
+    RasterizePatch(patches[j],j,center,right,up,forward,top);
+  }
+  // each patch gets the delta form factors of the pixels it won
+  const std::vector<double> &delta = top ? delta_top : delta_side;
+  for (int k = 0; k < num_pixels; k++) {
+    if (ids[k] >= 0) row[ids[k]] += delta[k];
+  }
+}
+
+// clip the polygon against the plane z = near (keep z > near)
+static int ClipNear(double (*in)[3], int num_in, double (*out)[3], double near) {
+  int num_out = 0;
+  for (int a = 0; a < num_in; a++) {
+    int b = (a+1) % num_in;
+    bool a_in = in[a][2] > near;
+    bool b_in = in[b][2] > near;
+    if (a_in) {
+      for (int c = 0; c < 3; c++) out[num_out][c] = in[a][c];
+      num_out++;
+    }
+    if (a_in != b_in) {
+      double t = (near - in[a][2]) / (in[b][2] - in[a][2]);
+      for (int c = 0; c < 3; c++) out[num_out][c] = in[a][c] + t * (in[b][c] - in[a][c]);
+      num_out++;
+    }
+  }
+  return num_out;
+}
+
+void Hemicube::RasterizePatch(const HemicubePatch &p, int id, const Vec3f &center,
+                              const Vec3f &right, const Vec3f &up, const Vec3f &forward, bool top) {
+  // into the coordinates of this face of the cube
+  double local[4][3];
+  bool any_in_front = false;
+  for (int k = 0; k < 4; k++) {
+    Vec3f v = p.verts[k] - center;
+    local[k][0] = v.Dot3(right);
+    local[k][1] = v.Dot3(up);
+    local[k][2] = v.Dot3(forward);
+    if (local[k][2] > 0) any_in_front = true;
+  }
+  if (!any_in_front) return;
+  double clipped[8][3];
+  int num = ClipNear(local,4,clipped,1e-9);
+  if (num < 3) return;
+
+  // project onto the face & find the pixel bounding box
+  double ymin = top ? -1 : 0;
+  int rows = top ? resolution : resolution/2;
+  double scale = 0.5 * resolution;
+  double sx[8], sy[8];
+  double min_x = DBL_MAX, max_x = -DBL_MAX, min_y = DBL_MAX, max_y = -DBL_MAX;
+  for (int k = 0; k < num; k++) {
+    sx[k] = (clipped[k][0] / clipped[k][2] + 1) * scale;
+    sy[k] = (clipped[k][1] / clipped[k][2] - ymin) * scale;
+    min_x = my_min(min_x,sx[k]); max_x = my_max(max_x,sx[k]);
+    min_y = my_min(min_y,sy[k]); max_y = my_max(max_y,sy[k]);
+  }
+  int x0 = my_max(0,(int)floor(min_x));
+  int x1 = my_min(resolution-1,(int)ceil(max_x));
+  int y0 = my_max(0,(int)floor(min_y));
+  int y1 = my_min(rows-1,(int)ceil(max_y));
+  if (x0 > x1 || y0 > y1) return;
+
+  // the polygon may wind either way on screen
+  double area = 0;
+  for (int k = 0; k < num; k++) {
+    int k2 = (k+1) % num;
+    area += sx[k]*sy[k2] - sx[k2]*sy[k];
+  }
+  if (area == 0) return;
+  double sign = (area > 0) ? 1 : -1;
+
+  // the distance along each pixel's ray to the patch plane:
+  // t = ((p0-center).n) / (d.n) with d = x*right + y*up + forward
+  Vec3f n = p.normal;
+  double numer = (p.verts[0]-center).Dot3(n);
+  double rn = right.Dot3(n);
+  double un = up.Dot3(n);
+  double fn = forward.Dot3(n);
+  double pixel = 2.0 / resolution;
+
+  for (int py = y0; py <= y1; py++) {
+    double cy = py + 0.5;
+    double y = ymin + cy * pixel;
+    for (int px = x0; px <= x1; px++) {
+      double cx = px + 0.5;
+      bool inside = true;
+      for (int k = 0; k < num && inside; k++) {
+        int k2 = (k+1) % num;
+        double e = (sx[k2]-sx[k])*(cy-sy[k]) - (sy[k2]-sy[k])*(cx-sx[k]);
+        if (sign * e < 0) inside = false;
+      }
+      if (!inside) continue;
+      double x = -1 + cx * pixel;
+      double denom = x*rn + y*un + fn;
+      if (denom == 0) continue;
+      double t = numer / denom;
+      if (t <= 0) continue;
+      int k = py*resolution+px;
+      if (t < depth[k]) {
+        depth[k] = t;
+        // the back of a patch blocks the view, but doesn't emit
+        ids[k] = (denom < 0) ? id : -1;
+      }
+    }
+  }
+}
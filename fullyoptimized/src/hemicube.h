@@ -0,0 +1,61 @@
+#ifndef _HEMICUBE_H_
+#define _HEMICUBE_H_
+
+#include <vector>
+#include "vectors.h"
+
+// ====================================================================
+// the geometry of one radiosity patch, copied out of the mesh so
+// several hemicubes can read it at once
+
+struct HemicubePatch {
+  Vec3f verts[4];
+  Vec3f normal;
+  Vec3f centroid;
+};
+
+// ====================================================================
+// ====================================================================
+// A software hemicube (Cohen & Greenberg 1985).  All the patches are
+// projected onto the five faces of a half cube centered on the
+// receiving patch and z-buffered, then the precomputed delta form
+// factors of the pixels each patch wins are summed.  That gives a
+// complete row of form factors (with occlusion) in one pass.
+//
+// Each thread needs its own Hemicube (it owns the z-buffer).
+
+class Hemicube {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  Hemicube(int resolution);
+
+  // row[j] = the form factor from patch i to patch j
+  void ComputeRow(const std::vector<HemicubePatch> &patches, int i, double *row);
+
+private:
+
+  // HELPER FUNCTIONS
+  void RenderFace(const std::vector<HemicubePatch> &patches, int i, double *row, const Vec3f &center,
+                  const Vec3f &right, const Vec3f &up, const Vec3f &forward, bool top);
+  void RasterizePatch(const HemicubePatch &p, int id, const Vec3f &center,
+                      const Vec3f &right, const Vec3f &up, const Vec3f &forward, bool top);
+
+  // ==============
+  // REPRESENTATION
+  int resolution;
+  // the z-buffer & patch ids of the face being rendered (the side
+  // faces only use the top half)
+  std::vector<double> depth;
+  std::vector<int> ids;
+  // the delta form factor of each pixel, for the top and the side faces
+  std::vector<double> delta_top;
+  std::vector<double> delta_side;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
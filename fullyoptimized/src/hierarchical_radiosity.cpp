@@ -0,0 +1,341 @@
+#include "hierarchical_radiosity.h"
+#include "argparser.h"
+#include "mesh.h"
+#include "face.h"
+#include "material.h"
+#include "raytracer.h"
+#include "utils.h"
+
+#include <map>
+
+// ================================================================
+// QUADTREE ELEMENTS
+// ================================================================
+
+HRElement::HRElement(Face *f, double _u0, double _u1, double _v0, double _v1, HRElement *parent) {
+  root_face = f;
+  u0 = _u0; u1 = _u1;
+  v0 = _v0; v1 = _v1;
+  for (int i = 0; i < 4; i++) children[i] = NULL;
+  Vec3f a = PointAt(u0,v0);
+  Vec3f b = PointAt(u1,v0);
+  Vec3f c = PointAt(u1,v1);
+  Vec3f d = PointAt(u0,v1);
+  area = AreaOfTriangle(a,b,c) + AreaOfTriangle(a,c,d);
+  centroid = PointAt(0.5*(u0+u1),0.5*(v0+v1));
+  if (parent == NULL) {
+    normal = f->computeNormal();
+    emitted = f->getMaterial()->getEmittedColor();
+    reflectance = f->getMaterial()->getDiffuseColor();
+    radiosity = emitted;
+  } else {
+    normal = parent->normal;
+    emitted = parent->emitted;
+    reflectance = parent->reflectance;
+    radiosity = parent->radiosity;
+  }
+}
+
+HRElement::~HRElement() {
+  for (int i = 0; i < 4; i++) delete children[i];
+}
+
+Vec3f HRElement::PointAt(double u, double v) const {
+  // bilinear interpolation of the corners of the root quad
+  Vec3f a = (*root_face)[0]->get();
+  Vec3f b = (*root_face)[1]->get();
+  Vec3f c = (*root_face)[2]->get();
+  Vec3f d = (*root_face)[3]->get();
+  return (1-u)*(1-v)*a + u*(1-v)*b + u*v*c + (1-u)*v*d;
+}
+
+Vec3f HRElement::RandomPoint() const {
+  double u = u0 + GLOBAL_mtrand.rand()*(u1-u0);
+  double v = v0 + GLOBAL_mtrand.rand()*(v1-v0);
+  return PointAt(u,v);
+}
+
+const HRElement* HRElement::FindLeaf(double u, double v) const {
+  const HRElement *e = this;
+  while (!e->isLeaf()) {
+    double um = 0.5*(e->u0+e->u1);
+    double vm = 0.5*(e->v0+e->v1);
+    if (v < vm) e = (u < um) ? e->children[0] : e->children[1];
+    else        e = (u < um) ? e->children[3] : e->children[2];
+  }
+  return e;
+}
+
+void HRElement::Subdivide() {
+  assert (isLeaf());
+  double um = 0.5*(u0+u1);
+  double vm = 0.5*(v0+v1);
+  children[0] = new HRElement(root_face,u0,um,v0,vm,this);
+  children[1] = new HRElement(root_face,um,u1,v0,vm,this);
+  children[2] = new HRElement(root_face,um,u1,vm,v1,this);
+  children[3] = new HRElement(root_face,u0,um,vm,v1,this);
+}
+
+// ================================================================
+// CONSTRUCTOR & DESTRUCTOR
+// ================================================================
+
+HierarchicalRadiosity::HierarchicalRadiosity(Mesh *m, ArgParser *a, RayTracer *r) {
+  mesh = m;
+  args = a;
+  raytracer = r;
+  initialized = false;
+  num_links = 0;
+  num_elements = 0;
+
+  // the quadtrees are built on top of the original quads (not the
+  // subdivided ones) and the rasterized primitive faces
+  total_area = 0;
+  for (int i = 0; i < mesh->numOriginalQuads(); i++) {
+    roots.push_back(new HRElement(mesh->getOriginalQuad(i),0,1,0,1,NULL));
+  }
+  for (int i = 0; i < mesh->numRasterizedPrimitiveFaces(); i++) {
+    roots.push_back(new HRElement(mesh->getRasterizedPrimitiveFace(i),0,1,0,1,NULL));
+  }
+  for (unsigned int i = 0; i < roots.size(); i++) {
+    total_area += roots[i]->getArea();
+  }
+  min_area = args->hierarchical_min_area;
+  if (min_area <= 0) min_area = 0.0001 * total_area;
+}
+
+HierarchicalRadiosity::~HierarchicalRadiosity() {
+  for (unsigned int i = 0; i < roots.size(); i++) delete roots[i];
+}
+
+// ================================================================
+// find the root & parametric location of every radiosity patch, so
+// the (independent) display mesh can look up the solution
+
+void HierarchicalRadiosity::LocatePatches() {
+  std::map<Face*,int> root_index;
+  for (unsigned int r = 0; r < roots.size(); r++) {
+    root_index[roots[r]->getRootFace()] = r;
+  }
+  int num_faces = mesh->numFaces();
+  patch_root.resize(num_faces);
+  patch_u.resize(num_faces);
+  patch_v.resize(num_faces);
+  for (int i = 0; i < num_faces; i++) {
+    Face *f = mesh->getFace(i);
+    std::map<Face*,int>::iterator itr = root_index.find(f);
+    if (itr != root_index.end()) {
+      patch_root[i] = itr->second;
+      patch_u[i] = patch_v[i] = 0.5;
+      continue;
+    }
+    // a subdivided quad: find the original quad that contains its
+    // centroid (the original quads are treated as parallelograms)
+    Vec3f p = f->computeCentroid();
+    double best = -1;
+    patch_root[i] = -1;
+    for (int r = 0; r < mesh->numOriginalQuads(); r++) {
+      Face *q = roots[r]->getRootFace();
+      Vec3f a = (*q)[0]->get();
+      Vec3f e1 = (*q)[1]->get() - a;
+      Vec3f e3 = (*q)[3]->get() - a;
+      Vec3f d = p - a;
+      double plane_dist = fabs(d.Dot3(roots[r]->getNormal()));
+      if (best >= 0 && plane_dist >= best) continue;
+      double a11 = e1.Dot3(e1), a12 = e1.Dot3(e3), a22 = e3.Dot3(e3);
+      double det = a11*a22 - a12*a12;
+      if (fabs(det) < 1e-12) continue;
+      double u = (a22*e1.Dot3(d) - a12*e3.Dot3(d)) / det;
+      double v = (a11*e3.Dot3(d) - a12*e1.Dot3(d)) / det;
+      if (u < -0.001 || u > 1.001 || v < -0.001 || v > 1.001) continue;
+      best = plane_dist;
+      patch_root[i] = r;
+      patch_u[i] = my_min(1.0,my_max(0.0,u));
+      patch_v[i] = my_min(1.0,my_max(0.0,v));
+    }
+    assert (patch_root[i] >= 0);
+  }
+}
+
+// ================================================================
+// FORM FACTOR & VISIBILITY ESTIMATES
+// ================================================================
+
+double HierarchicalRadiosity::FormFactor(HRElement *p, HRElement *q) const {
+  // unoccluded form factor from p to q, treating q as a disk seen
+  // from the centroid of p
+  Vec3f d = q->getCentroid() - p->getCentroid();
+  double r2 = d.Dot3(d);
+  if (r2 <= 0) return 0;
+  d.Normalize();
+  double cos_p = p->getNormal().Dot3(d);
+  double cos_q = -q->getNormal().Dot3(d);
+  if (cos_p <= 0 || cos_q <= 0) return 0;
+  return q->getArea() * cos_p * cos_q / (M_PI * r2 + q->getArea());
+}
+
+double HierarchicalRadiosity::Visibility(HRElement *p, HRElement *q) const {
+  int num_samples = my_max(1,args->num_form_factor_samples);
+  int visible = 0;
+  for (int k = 0; k < num_samples; k++) {
+    // the first sample connects the centroids, the rest are random
+    Vec3f a = (k == 0) ? p->getCentroid() : p->RandomPoint();
+    Vec3f b = (k == 0) ? q->getCentroid() : q->RandomPoint();
+    Vec3f dir = b - a;
+    double dist = dir.Length();
+    dir.Normalize();
+    Ray r(a,dir);
+    Hit h;
+    if (!raytracer->CastRay(r,h,true) || h.getT() > dist - EPSILON) visible++;
+  }
+  return visible / double(num_samples);
+}
+
+// ================================================================
+// LINK REFINEMENT
+// ================================================================
+
+bool HierarchicalRadiosity::Subdividable(HRElement *e) const {
+  return e->isLeaf() ? (e->getArea() > 4*min_area) : false;
+}
+
+void HierarchicalRadiosity::Refine(HRElement *p, HRElement *q) {
+  // p gathers from q
+  double Fpq = FormFactor(p,q);
+  if (Fpq <= 0) return;
+  double bf = Fpq * q->radiosity.Length();
+  if (bf > args->hierarchical_epsilon) {
+    // too much energy is carried by this pair to represent it with a
+    // single link, split the larger of the two elements
+    HRElement *split = NULL;
+    if (p->getArea() >= q->getArea()) {
+      if (Subdividable(p) || !p->isLeaf()) split = p;
+      else if (Subdividable(q) || !q->isLeaf()) split = q;
+    } else {
+      if (Subdividable(q) || !q->isLeaf()) split = q;
+      else if (Subdividable(p) || !p->isLeaf()) split = p;
+    }
+    if (split != NULL) {
+      if (split->isLeaf()) split->Subdivide();
+      for (int i = 0; i < 4; i++) {
+        if (split == p) Refine(p->getChild(i),q);
+        else Refine(p,q->getChild(i));
+      }
+      return;
+    }
+  }
+  double V = Visibility(p,q);
+  if (V <= 0) return;
+  p->links.push_back(HRLink(q,Fpq,V));
+  num_links++;
+}
+
+void HierarchicalRadiosity::RefineLinks(HRElement *p) {
+  // re-evaluate the existing links with the current radiosity values
+  std::vector<HRElement*> todo;
+  for (unsigned int i = 0; i < p->links.size(); i++) {
+    HRLink &l = p->links[i];
+    if (l.formfactor * l.source->radiosity.Length() <= args->hierarchical_epsilon) continue;
+    if (!Subdividable(p) && !Subdividable(l.source) && p->isLeaf() && l.source->isLeaf()) continue;
+    todo.push_back(l.source);
+    p->links[i] = p->links.back();
+    p->links.pop_back();
+    num_links--;
+    i--;
+  }
+  for (unsigned int i = 0; i < todo.size(); i++) {
+    Refine(p,todo[i]);
+  }
+  if (!p->isLeaf()) {
+    for (int i = 0; i < 4; i++) RefineLinks(p->getChild(i));
+  }
+}
+
+// ================================================================
+// SOLVER
+// ================================================================
+
+void HierarchicalRadiosity::Gather(HRElement *p) {
+  Vec3f g;
+  for (unsigned int i = 0; i < p->links.size(); i++) {
+    const HRLink &l = p->links[i];
+    g += (l.formfactor * l.visibility) * l.source->radiosity;
+  }
+  p->gathered = p->reflectance * g;
+  if (!p->isLeaf()) {
+    for (int i = 0; i < 4; i++) Gather(p->getChild(i));
+  }
+}
+
+Vec3f HierarchicalRadiosity::PushPull(HRElement *p, const Vec3f &down) {
+  // push the light gathered at the ancestors down to the leaves and
+  // pull the area weighted average back up
+  Vec3f pushed = down + p->gathered;
+  if (p->isLeaf()) {
+    p->radiosity = p->emitted + pushed;
+  } else {
+    Vec3f up;
+    double total = 0;
+    for (int i = 0; i < 4; i++) {
+      HRElement *c = p->getChild(i);
+      up += c->getArea() * PushPull(c,pushed);
+      total += c->getArea();
+    }
+    if (total > 0) up /= total;
+    p->radiosity = up;
+  }
+  return p->radiosity;
+}
+
+void HierarchicalRadiosity::CountElements(HRElement *p) {
+  num_elements++;
+  if (!p->isLeaf()) {
+    for (int i = 0; i < 4; i++) CountElements(p->getChild(i));
+  }
+}
+
+double HierarchicalRadiosity::Iterate() {
+  int num_roots = roots.size();
+  int old_links = num_links;
+  int old_elements = num_elements;
+  if (!initialized) {
+    // initial linking of every pair of roots (only the emitters are
+    // bright enough to force refinement at this point)
+    for (int i = 0; i < num_roots; i++) {
+      for (int j = 0; j < num_roots; j++) {
+        if (i != j) Refine(roots[i],roots[j]);
+      }
+    }
+    LocatePatches();
+    initialized = true;
+  } else {
+    // the radiosity estimates changed, some links may need refinement
+    for (int i = 0; i < num_roots; i++) RefineLinks(roots[i]);
+  }
+  num_elements = 0;
+  for (int i = 0; i < num_roots; i++) CountElements(roots[i]);
+  // only report the hierarchy when the refinement changed it
+  if (num_links != old_links || num_elements != old_elements) {
+    std::cout << "hierarchical radiosity: " << num_elements << " elements, "
+              << num_links << " links" << std::endl;
+  }
+
+  // a single Jacobi style sweep over the hierarchy
+  std::vector<Vec3f> before(num_roots);
+  for (int i = 0; i < num_roots; i++) before[i] = roots[i]->radiosity;
+  for (int i = 0; i < num_roots; i++) Gather(roots[i]);
+  for (int i = 0; i < num_roots; i++) PushPull(roots[i],Vec3f(0,0,0));
+
+  double change = 0;
+  for (int i = 0; i < num_roots; i++) {
+    change += roots[i]->getArea() * (roots[i]->radiosity - before[i]).Length();
+  }
+  return change / total_area;
+}
+
+Vec3f HierarchicalRadiosity::getPatchRadiance(int i) const {
+  assert (initialized);
+  assert (i >= 0 && i < (int)patch_root.size());
+  const HRElement *leaf = roots[patch_root[i]]->FindLeaf(patch_u[i],patch_v[i]);
+  return leaf->radiosity;
+}
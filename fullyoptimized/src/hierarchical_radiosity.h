@@ -0,0 +1,142 @@
+#ifndef _HIERARCHICAL_RADIOSITY_H_
+#define _HIERARCHICAL_RADIOSITY_H_
+
+#include <cassert>
+#include <vector>
+#include "vectors.h"
+
+class Mesh;
+class Face;
+class ArgParser;
+class RayTracer;
+class HRElement;
+
+// ====================================================================
+// A link carries light from a source element to the element that
+// stores it.  The form factor is from the storing (receiving) element
+// to the source, so gathering is B_p += rho_p * F_pq * B_q.
+
+struct HRLink {
+  HRLink(HRElement *q, double f, double v) : source(q), formfactor(f), visibility(v) {}
+  HRElement *source;
+  double formfactor;   // unoccluded estimate
+  double visibility;   // fraction of sample rays that got through
+};
+
+// ====================================================================
+// A node of the patch quadtree.  Each node covers the parametric
+// rectangle [u0,u1]x[v0,v1] of a root quad (an original quad or a
+// rasterized primitive face).
+
+class HRElement {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  HRElement(Face *f, double u0, double u1, double v0, double v1, HRElement *parent);
+  ~HRElement();
+
+  // =========
+  // ACCESSORS
+  Face* getRootFace() const { return root_face; }
+  bool isLeaf() const { return children[0] == NULL; }
+  HRElement* getChild(int i) const {
+    assert (i >= 0 && i < 4);
+    assert (!isLeaf());
+    return children[i]; }
+  double getArea() const { return area; }
+  const Vec3f& getCentroid() const { return centroid; }
+  const Vec3f& getNormal() const { return normal; }
+  Vec3f PointAt(double u, double v) const;
+  Vec3f RandomPoint() const;
+  // find the leaf that contains the parametric location (u,v)
+  const HRElement* FindLeaf(double u, double v) const;
+
+  // =========
+  // MODIFIERS
+  void Subdivide();
+
+  // ==============
+  // REPRESENTATION
+  // the radiosity values are accessed directly by the solver
+  Vec3f emitted;
+  Vec3f reflectance;
+  Vec3f radiosity;   // B, including everything pushed down from the ancestors
+  Vec3f gathered;    // light gathered over the links stored at this node
+  std::vector<HRLink> links;
+
+private:
+
+  Face *root_face;
+  double u0,u1,v0,v1;
+  HRElement *children[4];
+  double area;
+  Vec3f centroid;
+  Vec3f normal;
+};
+
+// ====================================================================
+// ====================================================================
+// Hanrahan-style hierarchical radiosity.  Links between two elements
+// are created at the coarsest level where the estimated transport
+// (F * B) falls below an error bound, so the number of links grows
+// roughly linearly with the number of elements instead of
+// quadratically.
+
+class HierarchicalRadiosity {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  HierarchicalRadiosity(Mesh *m, ArgParser *a, RayTracer *r);
+  ~HierarchicalRadiosity();
+
+  // one refine + gather + push/pull pass, returns the (area weighted)
+  // average change in radiosity
+  double Iterate();
+
+  // =========
+  // ACCESSORS
+  // the solution at the centroid of the i-th radiosity patch of the mesh
+  Vec3f getPatchRadiance(int i) const;
+  int numLinks() const { return num_links; }
+  int numElements() const { return num_elements; }
+
+private:
+
+  // HELPER FUNCTIONS
+  void LocatePatches();
+  void Refine(HRElement *p, HRElement *q);
+  void RefineLinks(HRElement *p);
+  bool Subdividable(HRElement *e) const;
+  double FormFactor(HRElement *p, HRElement *q) const;
+  double Visibility(HRElement *p, HRElement *q) const;
+  void Gather(HRElement *p);
+  Vec3f PushPull(HRElement *p, const Vec3f &down);
+  void CountElements(HRElement *p);
+
+  // ==============
+  // REPRESENTATION
+  Mesh *mesh;
+  ArgParser *args;
+  RayTracer *raytracer;
+
+  std::vector<HRElement*> roots;
+  // for each radiosity patch of the mesh: which root and where in it
+  std::vector<int> patch_root;
+  std::vector<double> patch_u;
+  std::vector<double> patch_v;
+
+  double min_area;
+  double total_area;
+  bool initialized;
+  int num_links;
+  int num_elements;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
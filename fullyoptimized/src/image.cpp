@@ -47,10 +47,12 @@ bool Image::Load(const std::string &filename) {
     return false;
   }
 
-  // misc header information
+  // misc header information (binary P6, or P3 as written by some
+  // screen capture tools)
   char tmp[100];
   fgets(tmp,100,file); 
-  assert (strstr(tmp,"P6"));
+  bool ascii = (strstr(tmp,"P3") != NULL);
+  assert (ascii || strstr(tmp,"P6"));
   fgets(tmp,100,file); 
   while (tmp[0] == '#') { fgets(tmp,100,file); }
   sscanf(tmp,"%d %d",&width,&height);
@@ -64,9 +66,13 @@ bool Image::Load(const std::string &filename) {
   for (int y = height-1; y >= 0; y--) {
     for (int x = 0; x < width; x++) {
       Color c;
-      c.r = fgetc(file);
-      c.g = fgetc(file);
-      c.b = fgetc(file);
+      if (ascii) {
+        if (fscanf(file,"%d %d %d",&c.r,&c.g,&c.b) != 3) c = Color(0,0,0);
+      } else {
+        c.r = fgetc(file);
+        c.g = fgetc(file);
+        c.b = fgetc(file);
+      }
       SetPixel(x,y,c);
     }
   }
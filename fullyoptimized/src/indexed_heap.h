@@ -0,0 +1,104 @@
+#ifndef _INDEXED_HEAP_H_
+#define _INDEXED_HEAP_H_
+
+#include <cassert>
+#include <vector>
+
+// ====================================================================
+// ====================================================================
+// A binary max heap over the indices 0..n-1, each with a key.  The
+// heap remembers where every index is stored, so a single key can be
+// changed in O(log n) and the largest key is found in O(1).  The sum
+// of all the keys is kept up to date as well.
+
+class IndexedMaxHeap {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & INITIALIZE
+  IndexedMaxHeap() { total = 0; }
+  // build the heap in O(n)
+  void Initialize(const std::vector<double> &k) {
+    keys = k;
+    int n = keys.size();
+    heap.resize(n);
+    position.resize(n);
+    total = 0;
+    for (int i = 0; i < n; i++) {
+      heap[i] = i;
+      position[i] = i;
+      total += keys[i];
+    }
+    for (int i = n/2-1; i >= 0; i--) {
+      SiftDown(i);
+    }
+  }
+
+  // =========
+  // ACCESSORS
+  int size() const { return heap.size(); }
+  int Top() const {
+    assert (!heap.empty());
+    return heap[0]; }
+  double getKey(int i) const {
+    assert (i >= 0 && i < size());
+    return keys[i]; }
+  double getTotal() const { return total; }
+
+  // =========
+  // MODIFIERS
+  void Update(int i, double key) {
+    assert (i >= 0 && i < size());
+    double old = keys[i];
+    if (key == old) return;
+    keys[i] = key;
+    total += key - old;
+    if (key > old) SiftUp(position[i]);
+    else SiftDown(position[i]);
+  }
+
+private:
+
+  // HELPER FUNCTIONS
+  void Swap(int a, int b) {
+    int tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    position[heap[a]] = a;
+    position[heap[b]] = b;
+  }
+  void SiftUp(int p) {
+    while (p > 0) {
+      int parent = (p-1)/2;
+      if (keys[heap[parent]] >= keys[heap[p]]) break;
+      Swap(p,parent);
+      p = parent;
+    }
+  }
+  void SiftDown(int p) {
+    int n = heap.size();
+    while (true) {
+      int largest = p;
+      int left = 2*p+1;
+      int right = 2*p+2;
+      if (left < n && keys[heap[left]] > keys[heap[largest]]) largest = left;
+      if (right < n && keys[heap[right]] > keys[heap[largest]]) largest = right;
+      if (largest == p) break;
+      Swap(p,largest);
+      p = largest;
+    }
+  }
+
+  // ==============
+  // REPRESENTATION
+  std::vector<int> heap;      // the indices, in heap order
+  std::vector<int> position;  // where each index is in the heap
+  std::vector<double> keys;   // indexed by the index, not heap order
+  double total;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -110,6 +110,39 @@ void KDTree::CollectPhotonsInBox(const BoundingBox &bb, std::vector<Photon> &pho
 }
 
 
+// ==================================================================
+void KDTree::CountPhotonsInSphere(const Vec3f &center, double radius, const Vec3f &normal,
+                                  int &num_direct, int &num_shadow) const {
+  num_direct = 0;
+  num_shadow = 0;
+  BoundingBox bb(center-Vec3f(radius,radius,radius),center+Vec3f(radius,radius,radius));
+  double radius2 = radius*radius;
+  // the tree is at most MAX_DEPTH deep, so the queue stays small
+  const KDTree *todo[2*MAX_DEPTH+2];
+  int num_todo = 0;
+  todo[num_todo++] = this;
+  while (num_todo > 0) {
+    const KDTree *node = todo[--num_todo];
+    if (!node->overlaps(bb)) continue;
+    if (node->isLeaf()) {
+      const std::vector<Photon> &photons2 = node->getPhotons();
+      int num_photons = photons2.size();
+      for (int i = 0; i < num_photons; i++) {
+        const Photon &p = photons2[i];
+        if (normal.Dot3(p.getDirectionFrom()) >= 0) continue;
+        Vec3f d = p.getPosition() - center;
+        if (d.Dot3(d) > radius2) continue;
+        if (p.isShadow()) num_shadow++;
+        else num_direct++;
+      }
+    } else {
+      todo[num_todo++] = node->getChild1();
+      todo[num_todo++] = node->getChild2();
+    }
+  }
+}
+
+
 // ==================================================================
 void KDTree::SplitCell() {
   const Vec3f& min = bbox.getMin();
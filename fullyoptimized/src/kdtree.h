@@ -42,6 +42,10 @@ class KDTree {
   // photons
   const std::vector<Photon>& getPhotons() const { return photons; }
   void CollectPhotonsInBox(const BoundingBox &bb, std::vector<Photon> &photons) const;
+  // count (without copying) the direct & shadow photons within radius
+  // of center that arrive at the front of a surface facing normal
+  void CountPhotonsInSphere(const Vec3f &center, double radius, const Vec3f &normal,
+                            int &num_direct, int &num_shadow) const;
 
   // =========
   // MODIFIERS
@@ -0,0 +1,178 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#include "light_bvh.h"
+#include "light_sampler.h"
+#include "utils.h"
+
+#define BACKFACING_LIGHT_WEIGHT 0.05
+
+// ====================================================================
+// NORMAL CONES
+// ====================================================================
+
+static double AngleBetween(const Vec3f &a, const Vec3f &b) {
+  double c = a.Dot3(b);
+  return acos(my_max(-1.0,my_min(1.0,c)));
+}
+
+// the smallest cone (axis, theta) containing both cones
+static void UnionCone(Vec3f &axis, double &theta, const Vec3f &axis2, double theta2) {
+  Vec3f a = axis, b = axis2;
+  double ta = theta, tb = theta2;
+  if (tb > ta) { std::swap(a,b); std::swap(ta,tb); }
+  double theta_d = AngleBetween(a,b);
+  if (my_min(theta_d + tb, M_PI) <= ta) { axis = a; theta = ta; return; }
+  double theta_o = (ta + theta_d + tb) / 2;
+  if (theta_o >= M_PI) { axis = a; theta = M_PI; return; }
+  // rotate a towards b by theta_o - ta
+  double theta_r = theta_o - ta;
+  Vec3f perpendicular = b - a.Dot3(b) * a;
+  if (perpendicular.Length() < 1e-9) {
+    // opposite axes, any perpendicular will do
+    Vec3f other = (fabs(a.x()) < 0.9) ? Vec3f(1,0,0) : Vec3f(0,1,0);
+    Vec3f::Cross3(perpendicular,a,other);
+  }
+  perpendicular.Normalize();
+  axis = cos(theta_r) * a + sin(theta_r) * perpendicular;
+  axis.Normalize();
+  theta = theta_o;
+}
+
+// ====================================================================
+// CONSTRUCTION
+// ====================================================================
+
+void LightBVH::Build(const std::vector<LightInfo> &lights) {
+  nodes.clear();
+  if (lights.empty()) return;
+  std::vector<int> order(lights.size());
+  for (unsigned int i = 0; i < lights.size(); i++) order[i] = i;
+  nodes.reserve(2*lights.size());
+  BuildNode(lights,order,0,lights.size());
+}
+
+// orders lights by their centroid along one axis
+struct CentroidLess {
+  CentroidLess(const std::vector<LightInfo> &l, int a) : lights(l), axis(a) {}
+  bool operator()(int a, int b) const { return lights[a].centroid[axis] < lights[b].centroid[axis]; }
+  const std::vector<LightInfo> &lights;
+  int axis;
+};
+
+// split at the median light centroid along the longest axis
+int LightBVH::BuildNode(const std::vector<LightInfo> &lights, std::vector<int> &order, int first, int last) {
+  int index = nodes.size();
+  nodes.push_back(Node());
+  if (last - first == 1) {
+    const LightInfo &light = lights[order[first]];
+    Node &leaf = nodes[index];
+    leaf.minimum = leaf.maximum = light.corners[0];
+    for (int k = 1; k < 4; k++) {
+      const Vec3f &c = light.corners[k];
+      leaf.minimum = Vec3f(my_min(leaf.minimum.x(),c.x()),my_min(leaf.minimum.y(),c.y()),my_min(leaf.minimum.z(),c.z()));
+      leaf.maximum = Vec3f(my_max(leaf.maximum.x(),c.x()),my_max(leaf.maximum.y(),c.y()),my_max(leaf.maximum.z(),c.z()));
+    }
+    leaf.axis = light.normal;
+    leaf.axis.Normalize();
+    leaf.theta_o = 0;
+    leaf.power = light.power;
+    leaf.child[0] = leaf.child[1] = -1;
+    leaf.light = order[first];
+    return index;
+  }
+
+  Vec3f lo = lights[order[first]].centroid, hi = lo;
+  for (int i = first+1; i < last; i++) {
+    const Vec3f &c = lights[order[i]].centroid;
+    lo = Vec3f(my_min(lo.x(),c.x()),my_min(lo.y(),c.y()),my_min(lo.z(),c.z()));
+    hi = Vec3f(my_max(hi.x(),c.x()),my_max(hi.y(),c.y()),my_max(hi.z(),c.z()));
+  }
+  Vec3f extent = hi - lo;
+  int axis = 0;
+  if (extent.y() > extent[axis]) axis = 1;
+  if (extent.z() > extent[axis]) axis = 2;
+  int middle = (first + last) / 2;
+  std::nth_element(order.begin()+first,order.begin()+middle,order.begin()+last,
+                   CentroidLess(lights,axis));
+
+  int left = BuildNode(lights,order,first,middle);
+  int right = BuildNode(lights,order,middle,last);
+  // (nodes may have moved while the children were built)
+  Node &node = nodes[index];
+  const Node &a = nodes[left];
+  const Node &b = nodes[right];
+  node.minimum = Vec3f(my_min(a.minimum.x(),b.minimum.x()),my_min(a.minimum.y(),b.minimum.y()),my_min(a.minimum.z(),b.minimum.z()));
+  node.maximum = Vec3f(my_max(a.maximum.x(),b.maximum.x()),my_max(a.maximum.y(),b.maximum.y()),my_max(a.maximum.z(),b.maximum.z()));
+  node.axis = a.axis;
+  node.theta_o = a.theta_o;
+  UnionCone(node.axis,node.theta_o,b.axis,b.theta_o);
+  node.power = a.power + b.power;
+  node.child[0] = left;
+  node.child[1] = right;
+  node.light = -1;
+  return index;
+}
+
+// ====================================================================
+// SAMPLING
+// ====================================================================
+
+// power * (bound on the emitter cosine) * (bound on the receiver
+// cosine) / distance^2, with the angles widened by the angle the box
+// subtends from p.  only the receiver side can rule a node out
+double LightBVH::Importance(const Node &node, const Vec3f &p, const Vec3f &n) const {
+  if (node.power <= 0) return 0;
+  Vec3f center = 0.5 * (node.minimum + node.maximum);
+  double radius = 0.5 * (node.maximum - node.minimum).Length();
+  Vec3f d = p - center;
+  double dist = d.Length();
+  if (dist <= radius) {
+    // inside the bounding sphere nothing can be ruled out
+    return node.power / my_max(radius*radius,1e-12);
+  }
+  d.Normalize();
+  double theta_u = asin(radius / dist);
+  // the emitter side: favor lights facing p.  Material::Shade gives
+  // an area light no falloff away from its normal, so lights facing
+  // away still get a small share rather than none
+  double theta = AngleBetween(node.axis,d);
+  double theta_e = my_max(0.0,theta - node.theta_o - theta_u);
+  double cos_e = (theta_e < M_PI/2) ? my_max(cos(theta_e),BACKFACING_LIGHT_WEIGHT) : BACKFACING_LIGHT_WEIGHT;
+  // the receiver side: p must face some part of the box
+  double theta_i = AngleBetween(n,-1*d);
+  double theta_r = my_max(0.0,theta_i - theta_u);
+  if (theta_r >= M_PI/2) return 0;
+  return node.power * cos_e * cos(theta_r) / my_max(dist*dist,radius*radius);
+}
+
+int LightBVH::Sample(const Vec3f &p, const Vec3f &n, double u, double &probability) const {
+  probability = 0;
+  if (nodes.empty()) return -1;
+  Vec3f normal = n;
+  normal.Normalize();
+  if (Importance(nodes[0],p,normal) <= 0) return -1;
+  double pdf = 1;
+  int index = 0;
+  while (nodes[index].light < 0) {
+    const Node &node = nodes[index];
+    double i0 = Importance(nodes[node.child[0]],p,normal);
+    double i1 = Importance(nodes[node.child[1]],p,normal);
+    if (i0 + i1 <= 0) return -1;
+    double p0 = i0 / (i0 + i1);
+    // reuse the random number for the next level
+    if (u < p0) {
+      u = u / p0;
+      pdf *= p0;
+      index = node.child[0];
+    } else {
+      u = (u - p0) / (1 - p0);
+      pdf *= 1 - p0;
+      index = node.child[1];
+    }
+    u = my_min(u,0.999999999);
+  }
+  probability = pdf;
+  return nodes[index].light;
+}
@@ -0,0 +1,59 @@
+#ifndef _LIGHT_BVH_H_
+#define _LIGHT_BVH_H_
+
+#include <vector>
+#include "vectors.h"
+
+struct LightInfo;
+
+// ====================================================================
+// ====================================================================
+// A bounding volume hierarchy over the area lights (Conty Estevez &
+// Kulla 2018).  Every node bounds its lights' positions with a box and
+// their normals with a cone, and stores their total power.  A light is
+// sampled by walking down from the root, picking each child in
+// proportion to a conservative estimate of how much it could light the
+// shading point, so the cost is logarithmic in the number of lights.
+//
+// The estimate is only zero when the bounds prove the point faces away
+// from the whole box, so the returned probability is never zero for a
+// light that contributes and the estimate stays unbiased.
+
+class LightBVH {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & INITIALIZE
+  LightBVH() {}
+  void Build(const std::vector<LightInfo> &lights);
+
+  // pick a light for point p with surface normal n using the uniform
+  // random number u in [0,1).  returns -1 if no light can reach p,
+  // otherwise the light & (in probability) the chance of picking it
+  int Sample(const Vec3f &p, const Vec3f &n, double u, double &probability) const;
+
+private:
+
+  struct Node {
+    Vec3f minimum, maximum;
+    Vec3f axis;          // the normal cone
+    double theta_o;      // its half angle
+    double power;
+    int child[2];        // internal nodes
+    int light;           // leaves (-1 for an internal node)
+  };
+
+  // HELPER FUNCTIONS
+  int BuildNode(const std::vector<LightInfo> &lights, std::vector<int> &order, int first, int last);
+  double Importance(const Node &node, const Vec3f &p, const Vec3f &n) const;
+
+  // ==============
+  // REPRESENTATION
+  std::vector<Node> nodes;   // nodes[0] is the root
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -0,0 +1,77 @@
+#include <cassert>
+
+#include "light_sampler.h"
+#include "face.h"
+#include "material.h"
+#include "utils.h"
+
+// ====================================================================
+// ====================================================================
+
+void LightSampler::Build(const std::vector<Face*> &faces) {
+  int n = faces.size();
+  lights.resize(n);
+  probability.resize(n);
+  threshold.resize(n);
+  alias.resize(n);
+  if (n == 0) return;
+
+  double total = 0;
+  for (int i = 0; i < n; i++) {
+    LightInfo &light = lights[i];
+    Face *f = faces[i];
+    light.face = f;
+    for (int k = 0; k < 4; k++) light.corners[k] = (*f)[k]->get();
+    light.centroid = f->computeCentroid();
+    light.normal = f->computeNormal();
+    light.area = f->getArea();
+    light.emitted = f->getMaterial()->getEmittedColor();
+    light.color = light.emitted * light.area;
+    light.power = (light.color.r() + light.color.g() + light.color.b()) / 3.0;
+    total += light.power;
+  }
+
+  // Vose: scale the probabilities so the average is 1, then pair off
+  // each small column with a large one that fills it up
+  std::vector<double> scaled(n);
+  std::vector<int> small, large;
+  for (int i = 0; i < n; i++) {
+    probability[i] = (total > 0) ? lights[i].power / total : 1.0 / n;
+    scaled[i] = probability[i] * n;
+    if (scaled[i] < 1) small.push_back(i);
+    else large.push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    int s = small.back(); small.pop_back();
+    int l = large.back(); large.pop_back();
+    threshold[s] = scaled[s];
+    alias[s] = l;
+    scaled[l] = (scaled[l] + scaled[s]) - 1;
+    if (scaled[l] < 1) small.push_back(l);
+    else large.push_back(l);
+  }
+  // whatever is left is (up to roundoff) exactly full
+  while (!large.empty()) {
+    int l = large.back(); large.pop_back();
+    threshold[l] = 1;
+    alias[l] = l;
+  }
+  while (!small.empty()) {
+    int s = small.back(); small.pop_back();
+    threshold[s] = 1;
+    alias[s] = s;
+  }
+
+  bvh.Build(lights);
+}
+
+int LightSampler::Sample(double u, double v) const {
+  int n = lights.size();
+  assert (n > 0);
+  int column = my_min(n-1,(int)(u*n));
+  return (v < threshold[column]) ? column : alias[column];
+}
+
+int LightSampler::SampleBVH(const Vec3f &p, const Vec3f &n, double u, double &probability) const {
+  return bvh.Sample(p,n,u,probability);
+}
@@ -0,0 +1,76 @@
+#ifndef _LIGHT_SAMPLER_H_
+#define _LIGHT_SAMPLER_H_
+
+#include <cassert>
+#include <vector>
+#include "vectors.h"
+#include "light_bvh.h"
+
+class Face;
+
+// ====================================================================
+// what the ray tracer needs to know about an area light, computed once
+// instead of at every hit
+
+struct LightInfo {
+  Face *face;
+  Vec3f corners[4];
+  Vec3f centroid;
+  Vec3f normal;
+  double area;
+  Vec3f emitted;
+  Vec3f color;     // emitted * area
+  double power;    // the average of the color channels
+};
+
+// ====================================================================
+// ====================================================================
+// The table of area lights, and an alias table (Vose's method) for
+// picking a light in proportion to its power in O(1), or through a
+// light BVH by its importance to a shading point.  The random numbers
+// come from the caller, so both are thread safe & repeatable.
+
+class LightSampler {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  LightSampler() {}
+  void Build(const std::vector<Face*> &lights);
+
+  // =========
+  // ACCESSORS
+  int numLights() const { return lights.size(); }
+  const LightInfo& getLight(int i) const {
+    assert (i >= 0 && i < numLights());
+    return lights[i]; }
+  // the probability of Sample returning light i
+  double getProbability(int i) const {
+    assert (i >= 0 && i < numLights());
+    return probability[i]; }
+
+  // pick a light with the sample (u,v) in [0,1)^2, brighter lights
+  // more often
+  int Sample(double u, double v) const;
+  // pick a light through the light BVH with the sample u in [0,1), by
+  // how much each could light point p (facing n).  returns -1 if none can
+  int SampleBVH(const Vec3f &p, const Vec3f &n, double u, double &probability) const;
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  std::vector<LightInfo> lights;
+  std::vector<double> probability;
+  // the alias table: column i keeps light i with chance threshold[i],
+  // otherwise it gives alias[i]
+  std::vector<double> threshold;
+  std::vector<int> alias;
+  LightBVH bvh;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
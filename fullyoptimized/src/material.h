@@ -6,6 +6,7 @@
 #include <string>
 #include "vectors.h"
 #include "image.h"
+#include "utils.h"
 
 class ArgParser;
 class Ray;
@@ -44,6 +45,11 @@ public:
   const Vec3f& getReflectiveColor() const { return reflectiveColor; }
   const Vec3f& getEmittedColor() const { return emittedColor; }  
   double getRoughness() const { return roughness; } 
+  // the exponent of the Phong lobe the reflected rays are spread over
+  // (roughness 0 is a mirror, roughness 1 is nearly diffuse)
+  double getGlossyExponent() const {
+    if (roughness <= 0) return 1e30;
+    return my_max(0.0, 2 / (roughness*roughness) - 2); }
   bool hasTextureMap() const { return (textureFile != ""); } 
   GLuint getTextureID();
 
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <string>
 #include <utility>
+#include <set>
 
 #include "vertex.h"
 #include "boundingbox.h"
@@ -30,12 +31,12 @@ Mesh::~Mesh() {
     removeFaceEdges(f);
     delete f;
   }
-  if (subdivided_quads.size() != original_quads.size()) {
-    for (i = 0; i < subdivided_quads.size(); i++) {
-      Face *f = subdivided_quads[i];
-      removeFaceEdges(f);
-      delete f;
-    }
+  for (i = 0; i < subdivided_quads.size(); i++) {
+    Face *f = subdivided_quads[i];
+    // unsplit original quads are deleted below
+    if (f->isOriginal()) continue;
+    removeFaceEdges(f);
+    delete f;
   }
   for (i = 0; i < original_quads.size(); i++) {
     Face *f = original_quads[i];
@@ -105,6 +106,7 @@ void Mesh::addFace(Vertex *a, Vertex *b, Vertex *c, Vertex *d, Material *materia
   if (ed_op != edges.end()) { ed_op->second->setOpposite(ed); }
   // add the face to the appropriate master list
   if (face_type == FACE_TYPE_ORIGINAL) {
+    f->setOriginal();
     original_quads.push_back(f);
     subdivided_quads.push_back(f);
   } else if (face_type == FACE_TYPE_RASTERIZED) {
@@ -142,6 +144,18 @@ void Mesh::removeFaceEdges(Face *f) {
   delete ed;
 }
 
+void Mesh::unlinkFaceEdges(Face *f) {
+  // the face (and its edges) are kept, but the edges are removed from
+  // the master list and disconnected from their neighbors
+  Edge *e = f->getEdge();
+  for (int i = 0; i < 4; i++) {
+    edges.erase(std::make_pair(e->getStartVertex(),e->getEndVertex()));
+    e->clearOpposite();
+    e = e->getNext();
+  }
+  assert (e == f->getEdge());
+}
+
 // ==============================================================================
 // EDGE HELPER FUNCTIONS
 
@@ -160,6 +174,34 @@ Vertex* Mesh::getChildVertex(Vertex *p1, Vertex *p2) const {
 void Mesh::setParentsChild(Vertex *p1, Vertex *p2, Vertex *child) {
   assert (vertex_parents.find(std::make_pair(p1,p2)) == vertex_parents.end());
   vertex_parents[std::make_pair(p1,p2)] = child; 
+  if ((int)child_parents.size() <= child->getIndex())
+    child_parents.resize(child->getIndex()+1,std::make_pair((Vertex*)NULL,(Vertex*)NULL));
+  child_parents[child->getIndex()] = std::make_pair(p1,p2);
+}
+
+bool Mesh::getParentVertices(Vertex *child, Vertex *&p1, Vertex *&p2) const {
+  if (child->getIndex() >= (int)child_parents.size()) return false;
+  p1 = child_parents[child->getIndex()].first;
+  p2 = child_parents[child->getIndex()].second;
+  return p1 != NULL;
+}
+
+Edge* Mesh::getCoarseEdge(Edge *e) const {
+  if (e->getOpposite() != NULL) return NULL;
+  Vertex *a = e->getStartVertex();
+  Vertex *b = e->getEndVertex();
+  Vertex *p1, *p2;
+  // a is the midpoint of (b,o), the neighbor runs from b to o
+  if (getParentVertices(a,p1,p2) && (p1 == b || p2 == b)) {
+    Vertex *o = (p1 == b) ? p2 : p1;
+    return getEdge(b,o);
+  }
+  // b is the midpoint of (a,o), the neighbor runs from o to a
+  if (getParentVertices(b,p1,p2) && (p1 == a || p2 == a)) {
+    Vertex *o = (p1 == a) ? p2 : p1;
+    return getEdge(o,a);
+  }
+  return NULL;
 }
 
 //
@@ -306,57 +348,95 @@ Vertex* Mesh::AddMidVertex(Vertex *a, Vertex *b, Vertex *c, Vertex *d) {
   return v;
 }
 
-void Mesh::Subdivision() {
+void Mesh::SplitQuad(Face *f) {
+  Vertex *a = (*f)[0];
+  Vertex *b = (*f)[1];
+  Vertex *c = (*f)[2];
+  Vertex *d = (*f)[3];
+  // add new vertices on the edges (or find the ones already added by
+  // a neighbor that was split earlier)
+  Vertex *ab = AddEdgeVertex(a,b);
+  Vertex *bc = AddEdgeVertex(b,c);
+  Vertex *cd = AddEdgeVertex(c,d);
+  Vertex *da = AddEdgeVertex(d,a);
+  // add new point in the middle of the patch
+  Vertex *mid = AddMidVertex(a,b,c,d);
+
+  assert (getEdge(a,b) != NULL);
+  assert (getEdge(b,c) != NULL);
+  assert (getEdge(c,d) != NULL);
+  assert (getEdge(d,a) != NULL);
 
-  bool first_subdivision = false;
-  if (original_quads.size() == subdivided_quads.size()) {
-    first_subdivision = true;
+  // copy the color and emission from the old patch to the new
+  Material *material = f->getMaterial();
+  if (f->isOriginal()) {
+    // the original quads are kept for ray tracing, but must not be
+    // found as neighbors of the subdivided quads
+    unlinkFaceEdges(f);
+  } else {
+    removeFaceEdges(f);
+    delete f;
   }
 
+  // create the new faces
+  addSubdividedQuad(a,ab,mid,da,material);
+  addSubdividedQuad(b,bc,mid,ab,material);
+  addSubdividedQuad(c,cd,mid,bc,material);
+  addSubdividedQuad(d,da,mid,cd,material);
+
+  assert (getEdge(a,ab) != NULL);
+  assert (getEdge(ab,b) != NULL);
+  assert (getEdge(b,bc) != NULL);
+  assert (getEdge(bc,c) != NULL);
+  assert (getEdge(c,cd) != NULL);
+  assert (getEdge(cd,d) != NULL);
+  assert (getEdge(d,da) != NULL);
+  assert (getEdge(da,a) != NULL);
+}
+
+void Mesh::Subdivision() {
   std::vector<Face*> tmp = subdivided_quads;
   subdivided_quads.clear();
-  
   for (unsigned int i = 0; i < tmp.size(); i++) {
-    Face *f = tmp[i];
-    
-    Vertex *a = (*f)[0];
-    Vertex *b = (*f)[1];
-    Vertex *c = (*f)[2];
-    Vertex *d = (*f)[3];
-    // add new vertices on the edges
-    Vertex *ab = AddEdgeVertex(a,b);
-    Vertex *bc = AddEdgeVertex(b,c);
-    Vertex *cd = AddEdgeVertex(c,d);
-    Vertex *da = AddEdgeVertex(d,a);
-    // add new point in the middle of the patch
-    Vertex *mid = AddMidVertex(a,b,c,d);
-
-    assert (getEdge(a,b) != NULL);
-    assert (getEdge(b,c) != NULL);
-    assert (getEdge(c,d) != NULL);
-    assert (getEdge(d,a) != NULL);
-
-    // copy the color and emission from the old patch to the new
-    Material *material = f->getMaterial();
-    if (!first_subdivision) {
-      removeFaceEdges(f);
-      delete f;
+    SplitQuad(tmp[i]);
+  }
+}
+
+int Mesh::AdaptiveSubdivision(const std::vector<bool> &refine) {
+  assert ((int)refine.size() == numFaces());
+  std::vector<Face*> tmp = subdivided_quads;
+
+  // mark the requested quads, then close the set: a quad lying along
+  // the longer edge of a coarser neighbor can only be split if the
+  // neighbor is split too (otherwise that edge would end up with two
+  // hanging vertices)
+  std::set<Face*> marked;
+  std::vector<Face*> todo;
+  for (unsigned int i = 0; i < tmp.size(); i++) {
+    if (!refine[i]) continue;
+    marked.insert(tmp[i]);
+    todo.push_back(tmp[i]);
+  }
+  while (!todo.empty()) {
+    Face *f = todo.back();
+    todo.pop_back();
+    Edge *e = f->getEdge();
+    for (int j = 0; j < 4; j++) {
+      Edge *coarse = getCoarseEdge(e);
+      if (coarse != NULL && marked.insert(coarse->getFace()).second) {
+        todo.push_back(coarse->getFace());
+      }
+      e = e->getNext();
     }
+  }
 
-    // create the new faces
-    addSubdividedQuad(a,ab,mid,da,material);
-    addSubdividedQuad(b,bc,mid,ab,material);
-    addSubdividedQuad(c,cd,mid,bc,material);
-    addSubdividedQuad(d,da,mid,cd,material);
-
-    assert (getEdge(a,ab) != NULL);
-    assert (getEdge(ab,b) != NULL);
-    assert (getEdge(b,bc) != NULL);
-    assert (getEdge(bc,c) != NULL);
-    assert (getEdge(c,cd) != NULL);
-    assert (getEdge(cd,d) != NULL);
-    assert (getEdge(d,da) != NULL);
-    assert (getEdge(da,a) != NULL);
+  subdivided_quads.clear();
+  for (unsigned int i = 0; i < tmp.size(); i++) {
+    if (marked.find(tmp[i]) != marked.end()) {
+      SplitQuad(tmp[i]);
+    } else {
+      subdivided_quads.push_back(tmp[i]);
+    }
   }
+  return marked.size();
 }
-
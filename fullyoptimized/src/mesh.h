@@ -48,6 +48,8 @@ public:
   // this accessor will find a child vertex (if it exists) when given
   // two parent vertices
   Vertex* getChildVertex(Vertex *p1, Vertex *p2) const;
+  // the reverse lookup, returns false if the vertex has no parents
+  bool getParentVertices(Vertex *child, Vertex *&p1, Vertex *&p2) const;
 
   // =====
   // EDGES
@@ -55,6 +57,10 @@ public:
   // this efficiently looks for an edge with the given vertices, using a hash table
   Edge* getEdge(Vertex *a, Vertex *b) const;
   const edgeshashtype& getEdges() const { return edges; }
+  // after adaptive subdivision, an edge with no opposite may be half of
+  // a longer edge of a coarser neighbor (a T-junction).  returns that
+  // coarser edge, or NULL.
+  Edge* getCoarseEdge(Edge *e) const;
 
   // =================
   // ACCESS THE LIGHTS
@@ -104,6 +110,11 @@ public:
   // ===============
   // OTHER FUNCTIONS
   void Subdivision();
+  // only split the subdivided quads flagged in refine (indexed like
+  // getFace), plus whatever neighbors must also be split so that no
+  // edge has more than one hanging vertex.  returns the number of
+  // quads split
+  int AdaptiveSubdivision(const std::vector<bool> &refine);
 
 private:
 
@@ -111,8 +122,10 @@ private:
   // HELPER FUNCTIONS FOR CREATING/SUBDIVIDING GEOMETRY
   Vertex* AddEdgeVertex(Vertex *a, Vertex *b);
   Vertex* AddMidVertex(Vertex *a, Vertex *b, Vertex *c, Vertex *d);
+  void SplitQuad(Face *f);
   void addFace(Vertex *a, Vertex *b, Vertex *c, Vertex *d, Material *material, enum FACE_TYPE face_type);
   void removeFaceEdges(Face *f);
+  void unlinkFaceEdges(Face *f);
   void addPrimitive(Primitive *p); 
 
   // ==============
@@ -131,6 +144,8 @@ private:
   std::vector<Vertex*> vertices;  
   edgeshashtype edges;
   vphashtype vertex_parents;
+  // indexed by child vertex index, NULL,NULL if not a child
+  std::vector<std::pair<Vertex*,Vertex*> > child_parents;
 
   // the quads from the .obj file (before subdivision)
   std::vector<Face*> original_quads;
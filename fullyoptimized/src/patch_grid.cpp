@@ -0,0 +1,154 @@
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+
+#include "patch_grid.h"
+#include "mesh.h"
+#include "face.h"
+#include "utils.h"
+
+// ====================================================================
+// CONSTRUCTION
+// ====================================================================
+
+int PatchGrid::CellCoordinate(double v, int axis) const {
+  int c = (int)floor((v - minimum[axis]) / cell_size);
+  return my_max(0,my_min(dims[axis]-1,c));
+}
+
+void PatchGrid::Build(Mesh *mesh) {
+  int n = mesh->numFaces();
+  corners.resize(4*n);
+  normals.resize(n);
+  if (n == 0) { cell_start.assign(1,0); cell_patches.clear(); return; }
+
+  Vec3f maximum;
+  double total_area = 0;
+  for (int i = 0; i < n; i++) {
+    Face *f = mesh->getFace(i);
+    for (int k = 0; k < 4; k++) {
+      const Vec3f &v = (*f)[k]->get();
+      corners[4*i+k] = v;
+      if (i == 0 && k == 0) { minimum = v; maximum = v; }
+      minimum = Vec3f(my_min(minimum.x(),v.x()),my_min(minimum.y(),v.y()),my_min(minimum.z(),v.z()));
+      maximum = Vec3f(my_max(maximum.x(),v.x()),my_max(maximum.y(),v.y()),my_max(maximum.z(),v.z()));
+    }
+    normals[i] = f->computeNormal();
+    normals[i].Normalize();
+    total_area += f->getArea();
+  }
+
+  // cells about twice the size of an average patch
+  cell_size = 2 * sqrt(total_area / n);
+  for (int axis = 0; axis < 3; axis++) {
+    double extent = maximum[axis] - minimum[axis];
+    dims[axis] = my_max(1,my_min(128,(int)ceil(extent / cell_size)));
+  }
+  double padding = 0.25 * cell_size;
+
+  // count, then fill in the patches of each cell
+  int num_cells = dims[0]*dims[1]*dims[2];
+  cell_start.assign(num_cells+1,0);
+  for (int pass = 0; pass < 2; pass++) {
+    std::vector<int> next;
+    if (pass == 1) {
+      for (int c = 0; c < num_cells; c++) cell_start[c+1] += cell_start[c];
+      cell_patches.resize(cell_start[num_cells]);
+      next.assign(cell_start.begin(),cell_start.end()-1);
+    }
+    for (int i = 0; i < n; i++) {
+      int lo[3], hi[3];
+      for (int axis = 0; axis < 3; axis++) {
+        double a = DBL_MAX, b = -DBL_MAX;
+        for (int k = 0; k < 4; k++) {
+          a = my_min(a,corners[4*i+k][axis]);
+          b = my_max(b,corners[4*i+k][axis]);
+        }
+        lo[axis] = CellCoordinate(a-padding,axis);
+        hi[axis] = CellCoordinate(b+padding,axis);
+      }
+      for (int z = lo[2]; z <= hi[2]; z++) {
+        for (int y = lo[1]; y <= hi[1]; y++) {
+          for (int x = lo[0]; x <= hi[0]; x++) {
+            int c = CellIndex(x,y,z);
+            if (pass == 0) cell_start[c+1]++;
+            else cell_patches[next[c]++] = i;
+          }
+        }
+      }
+    }
+  }
+}
+
+// ====================================================================
+// QUERIES
+// ====================================================================
+
+// barycentric coordinates of p (assumed in the plane) in triangle abc
+static void Barycentric(const Vec3f &p, const Vec3f &a, const Vec3f &b, const Vec3f &c,
+                        double &u, double &v, double &w) {
+  Vec3f e0 = b - a;
+  Vec3f e1 = c - a;
+  Vec3f e2 = p - a;
+  double d00 = e0.Dot3(e0);
+  double d01 = e0.Dot3(e1);
+  double d11 = e1.Dot3(e1);
+  double d20 = e2.Dot3(e0);
+  double d21 = e2.Dot3(e1);
+  double denom = d00*d11 - d01*d01;
+  if (fabs(denom) < 1e-20) { u = 1; v = w = 0; return; }
+  v = (d11*d20 - d01*d21) / denom;
+  w = (d00*d21 - d01*d20) / denom;
+  u = 1 - v - w;
+}
+
+int PatchGrid::Locate(const Vec3f &p, const Vec3f &normal, double weights[4]) const {
+  if (cell_patches.empty()) return -1;
+  int c = CellIndex(CellCoordinate(p.x(),0),CellCoordinate(p.y(),1),CellCoordinate(p.z(),2));
+  Vec3f n = normal;
+  n.Normalize();
+
+  // prefer the closest patch whose outline contains p, otherwise take
+  // the one with the nearest centroid (clamping the weights)
+  int best = -1;
+  bool best_inside = false;
+  double best_score = DBL_MAX;
+  for (int k = cell_start[c]; k < cell_start[c+1]; k++) {
+    int i = cell_patches[k];
+    if (normals[i].Dot3(n) < 0.5) continue;
+    const Vec3f *q = &corners[4*i];
+    double height = (p - q[0]).Dot3(normals[i]);
+    Vec3f projected = p - height*normals[i];
+    // split the quad along the 0-2 diagonal
+    double u, v, w;
+    double tri[4] = { 0, 0, 0, 0 };
+    Barycentric(projected,q[0],q[1],q[2],u,v,w);
+    if (v >= 0 && w >= 0) {
+      tri[0] = u; tri[1] = v; tri[2] = w;
+    } else {
+      Barycentric(projected,q[0],q[2],q[3],u,v,w);
+      tri[0] = u; tri[2] = v; tri[3] = w;
+    }
+    bool inside = tri[0] >= -1e-6 && tri[1] >= -1e-6 && tri[2] >= -1e-6 && tri[3] >= -1e-6;
+    double score;
+    if (inside) {
+      score = fabs(height);
+    } else {
+      score = (p - 0.25*(q[0]+q[1]+q[2]+q[3])).Length();
+    }
+    if (best != -1 && best_inside && !inside) continue;
+    if (best != -1 && (best_inside == inside) && score >= best_score) continue;
+    best = i;
+    best_inside = inside;
+    best_score = score;
+    double total = 0;
+    for (int j = 0; j < 4; j++) {
+      weights[j] = my_max(0.0,tri[j]);
+      total += weights[j];
+    }
+    for (int j = 0; j < 4; j++) {
+      weights[j] = (total > 0) ? weights[j]/total : 0.25;
+    }
+  }
+  return best;
+}
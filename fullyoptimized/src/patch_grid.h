@@ -0,0 +1,52 @@
+#ifndef _PATCH_GRID_H_
+#define _PATCH_GRID_H_
+
+#include <vector>
+#include "vectors.h"
+
+class Mesh;
+
+// ====================================================================
+// ====================================================================
+// A uniform grid over the radiosity patches, for finding the patch
+// under a ray hit.  Each cell lists the patches whose (slightly
+// padded) bounding box overlaps it, so a hit on the true sphere still
+// finds the flat patch approximating it.
+
+class PatchGrid {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & INITIALIZE
+  PatchGrid() { cell_size = 1; dims[0] = dims[1] = dims[2] = 0; }
+  void Build(Mesh *mesh);
+
+  // the patch under p (facing along normal) and the weights of its 4
+  // corners at p.  returns -1 if no patch is nearby
+  int Locate(const Vec3f &p, const Vec3f &normal, double weights[4]) const;
+
+private:
+
+  // HELPER FUNCTIONS
+  int CellCoordinate(double v, int axis) const;
+  int CellIndex(int x, int y, int z) const { return (z*dims[1]+y)*dims[0]+x; }
+
+  // ==============
+  // REPRESENTATION
+  // a copy of the patch corners & normals (the grid only needs geometry)
+  std::vector<Vec3f> corners;   // 4 per patch
+  std::vector<Vec3f> normals;
+  Vec3f minimum;
+  double cell_size;
+  int dims[3];
+  // the patches of cell c are cell_patches[cell_start[c]] up to
+  // cell_patches[cell_start[c+1]]
+  std::vector<int> cell_start;
+  std::vector<int> cell_patches;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -11,14 +11,16 @@ class Photon {
  public:
 
   // CONSTRUCTOR
-  Photon(const Vec3f &p, const Vec3f &d, const Vec3f &e, int b) :
-    position(p),direction_from(d),energy(e),bounce(b) {}
+  Photon(const Vec3f &p, const Vec3f &d, const Vec3f &e, int b, bool s = false) :
+    position(p),direction_from(d),energy(e),bounce(b),shadow(s) {}
 
   // ACCESSORS
   const Vec3f& getPosition() const { return position; }
   const Vec3f& getDirectionFrom() const { return direction_from; }
   const Vec3f& getEnergy() const { return energy; }
   int whichBounce() const { return bounce; }
+  // shadow photons mark where a light's direct path was blocked
+  bool isShadow() const { return shadow; }
   const Vec3f& getPoint() const {return tempPoint;}
 
   //MODIFIERS
@@ -33,6 +35,7 @@ class Photon {
   Vec3f energy;
   Vec3f tempPoint;
   int bounce;
+  bool shadow;
 };
 
 #endif
@@ -12,19 +12,28 @@
 #include "kdtree.h"
 #include "utils.h"
 #include "raytracer.h"
+#include "sampler.h"
 
 // ==========
 // DESTRUCTOR
 PhotonMapping::~PhotonMapping() {
   // cleanup all the photons
   delete kdtree;
+  ClearShadowTrees();
+}
+
+void PhotonMapping::ClearShadowTrees() {
+  for (unsigned int i = 0; i < shadow_kdtrees.size(); i++) {
+    delete shadow_kdtrees[i];
+  }
+  shadow_kdtrees.clear();
 }
 
 // ========================================================================
 // Recursively trace a single photon
 
 void PhotonMapping::TracePhoton(const Vec3f &position, const Vec3f &direction, 
-				const Vec3f &energy, int iter) {
+				const Vec3f &energy, int iter, KDTree *shadow_tree, int photon) {
 
 
   // ==============================================
@@ -44,6 +53,9 @@ void PhotonMapping::TracePhoton(const Vec3f &position, const Vec3f &direction,
   raytracer->CastRay(r,h,true);
   if (h.getT()>1000)
 	  return;
+  // the first hit is lit by the light, everything behind it is in its shadow
+  if (iter==0 && shadow_tree!=NULL)
+	  StoreShadowPhotons(r.pointAtParameter(h.getT()),r.getDirection(),energy,shadow_tree);
   MTRand mtrand;
   Vec3f refl = h.getMaterial()->getReflectiveColor();
   Vec3f diff = h.getMaterial()->getDiffuseColor();
@@ -53,9 +65,13 @@ void PhotonMapping::TracePhoton(const Vec3f &position, const Vec3f &direction,
   //std::cout<<iter<<" "<<h.getT()<<" "<<refl.Length()+diff.Length()<<std::endl;
   //send reflective photon
   if (iter<args->num_bounces&&ran<=refl.Length())
-	  TracePhoton(r.pointAtParameter(h.getT()),r.getDirection()-2*(r.getDirection().Dot3(h.getNormal()))*h.getNormal(),energy,iter+1);
+	  TracePhoton(r.pointAtParameter(h.getT()),r.getDirection()-2*(r.getDirection().Dot3(h.getNormal()))*h.getNormal(),energy,iter+1,NULL,photon);
   else if (iter<args->num_bounces&&ran<=refl.Length()+diff.Length())
-	  TracePhoton(r.pointAtParameter(h.getT()),RandomDiffuseDirection(h.getNormal()),energy,iter+1);
+  {
+	  double u, v;
+	  Sampler(args->sampler).Get2D(photon,args->num_photons_to_shoot,SAMPLE_PHOTON_BOUNCE+iter,0,u,v);
+	  TracePhoton(r.pointAtParameter(h.getT()),CosineDirection(h.getNormal(),u,v),energy,iter+1,NULL,photon);
+  }
   else
   {
 	  Photon p(position,direction,energy,iter);
@@ -66,6 +82,24 @@ void PhotonMapping::TracePhoton(const Vec3f &position, const Vec3f &direction,
 }
 
 
+// ========================================================================
+// Jensen's shadow photons: the first surface a light photon reaches gets
+// a direct photon, & the photon then continues straight on, leaving a
+// shadow photon on every surface behind it
+
+void PhotonMapping::StoreShadowPhotons(const Vec3f &position, const Vec3f &direction,
+                                       const Vec3f &energy, KDTree *shadow_tree) {
+  shadow_tree->AddPhoton(Photon(position,direction,energy,0));
+  Vec3f start = position;
+  for (int k = 0; k < 8; k++) {
+    Ray r(start,direction);
+    Hit h;
+    if (!raytracer->CastRay(r,h,true) || h.getT() > 1000) return;
+    start = r.pointAtParameter(h.getT());
+    shadow_tree->AddPhoton(Photon(start,direction,energy,0,true));
+  }
+}
+
 // ========================================================================
 // Trace the specified number of photons through the scene
 
@@ -74,6 +108,7 @@ void PhotonMapping::TracePhotons() {
 
   // first, throw away any existing photons
   delete kdtree;
+  ClearShadowTrees();
 
   // consruct a kdtree to store the photons
   BoundingBox *bb = mesh->getBoundingBox();
@@ -95,17 +130,29 @@ void PhotonMapping::TracePhotons() {
 
   // shoot a constant number of photons per unit area of light source
   // (alternatively, this could be based on the total energy of each light)
+  Sampler sampler(args->sampler);
+  int photon = 0;
   for (unsigned int i = 0; i < lights.size(); i++) {  
     double my_area = lights[i]->getArea();
     int num = args->num_photons_to_shoot * my_area / total_lights_area;
     // the initial energy for this photon
     Vec3f energy = my_area/double(num) * lights[i]->getMaterial()->getEmittedColor();
     Vec3f normal = lights[i]->computeNormal();
+    KDTree *shadow_tree = NULL;
+    if (args->shadow_photons) {
+      shadow_tree = new KDTree(BoundingBox(min,max));
+      shadow_kdtrees.push_back(shadow_tree);
+    }
     for (int j = 0; j < num; j++) {
-      Vec3f start = lights[i]->RandomPoint();
+      // spread the photons over the light & the hemisphere with the
+      // light's own scrambled sequence
+      double s, t, u, v;
+      sampler.Get2D(j,num,SAMPLE_PHOTON_POSITION,i,s,t);
+      sampler.Get2D(j,num,SAMPLE_PHOTON_DIRECTION,i,u,v);
+      Vec3f start = lights[i]->PointAt(s,t);
       // the initial direction for this photon (for diffuse light sources)
-      Vec3f direction = RandomDiffuseDirection(normal);
-      TracePhoton(start,direction,energy,0);
+      Vec3f direction = CosineDirection(normal,u,v);
+      TracePhoton(start,direction,energy,0,shadow_tree,photon++);
     }
   }
 }
@@ -180,6 +227,30 @@ Vec3f PhotonMapping::GatherIndirect(const Vec3f &point, const Vec3f &normal, con
 
 
 
+// ======================================================================
+// Classify a point against one light by the direct & shadow photons
+// nearby on the same side of the surface.  only when they disagree (or
+// there are too few nearby) does the ray tracer need shadow rays.
+
+enum LIGHT_VISIBILITY PhotonMapping::LightVisibility(int light, const Vec3f &point, const Vec3f &normal) const {
+  if (light < 0 || light >= (int)shadow_kdtrees.size()) return LIGHT_PARTIAL;
+  const KDTree *tree = shadow_kdtrees[light];
+  const int min_photons = 8;
+  double max_radius = 0.1 * mesh->getBoundingBox()->maxDim();
+  double radius = 0.01 * mesh->getBoundingBox()->maxDim();
+
+  // grow the search radius until enough photons are found
+  while (true) {
+    int num_direct, num_shadow;
+    tree->CountPhotonsInSphere(point,radius,normal,num_direct,num_shadow);
+    if (num_direct > 0 && num_shadow > 0) return LIGHT_PARTIAL;
+    if (num_direct >= min_photons) return LIGHT_VISIBLE;
+    if (num_shadow >= min_photons) return LIGHT_HIDDEN;
+    if (radius >= max_radius) return LIGHT_PARTIAL;
+    radius *= 2;
+  }
+}
+
 // ======================================================================
 // PHOTON VISUALIZATION FOR DEBUGGING
 // ======================================================================
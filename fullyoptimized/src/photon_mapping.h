@@ -14,6 +14,9 @@ class Hit;
 class RayTracer;
 class Radiosity;
 
+// how much of a light a point can see, from the shadow photons
+enum LIGHT_VISIBILITY { LIGHT_VISIBLE, LIGHT_HIDDEN, LIGHT_PARTIAL };
+
 // =========================================================================
 // The basic class to shoot photons within the scene and collect and
 // process the nearest photons for use in the raytracer
@@ -42,14 +45,24 @@ class PhotonMapping {
   void TracePhotons();
   // step 2: collect the photons and return the contribution from indirect illumination
   Vec3f GatherIndirect(const Vec3f &point, const Vec3f &normal, const Vec3f &direction_from) const;
+  // with -shadow_photons: is the light fully visible or fully hidden
+  // from the point?  LIGHT_PARTIAL means shadow rays are needed
+  enum LIGHT_VISIBILITY LightVisibility(int light, const Vec3f &point, const Vec3f &normal) const;
 
  private:
 
-  // trace a single photon
-  void TracePhoton(const Vec3f &position, const Vec3f &direction, const Vec3f &energy, int iter);
+  // trace a single photon (photon = its index among all the photons
+  // shot, which picks its bounce directions from the sample sequence)
+  void TracePhoton(const Vec3f &position, const Vec3f &direction, const Vec3f &energy, int iter,
+                   KDTree *shadow_tree = NULL, int photon = 0);
+  void StoreShadowPhotons(const Vec3f &position, const Vec3f &direction, const Vec3f &energy,
+                          KDTree *shadow_tree);
+  void ClearShadowTrees();
 
   // REPRESENTATION
   KDTree *kdtree;
+  // direct & shadow photons, one tree per light (-shadow_photons)
+  std::vector<KDTree*> shadow_kdtrees;
   Mesh *mesh;
   ArgParser *args;
   RayTracer *raytracer;
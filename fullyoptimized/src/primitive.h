@@ -6,6 +6,7 @@ class Ray;
 class Hit;
 class Material;
 class ArgParser;
+class Vec3f;
 
 // ====================================================================
 // The base class for implicit object representations.  These objects
@@ -21,6 +22,8 @@ class Primitive {
 
   // for ray tracing
   virtual bool intersect(const Ray &r, Hit &h) const = 0;
+  // an axis aligned box around the object (for culling ray packets)
+  virtual void getBounds(Vec3f &minimum, Vec3f &maximum) const = 0;
 
   // for OpenGL rendering & radiosity
   virtual void addRasterizedFaces(Mesh *m, ArgParser *args) = 0;
@@ -6,6 +6,8 @@
 #include "sphere.h"
 #include "raytree.h"
 #include "raytracer.h"
+#include "hierarchical_radiosity.h"
+#include "hemicube.h"
 #include "utils.h"
 
 // ================================================================
@@ -20,8 +22,10 @@ Radiosity::Radiosity(Mesh *m, ArgParser *a) {
   undistributed = NULL;
   absorbed = NULL;
   radiance = NULL;
+  hierarchical = NULL;
   max_undistributed_patch = -1;
   total_area = -1;
+  num_iterations = 0;
   Reset();
 }
 
@@ -36,12 +40,14 @@ void Radiosity::Cleanup() {
   delete [] undistributed;
   delete [] absorbed;
   delete [] radiance;
+  delete hierarchical;
   num_faces = -1;
   formfactors = NULL;
   area = NULL;
   undistributed = NULL;
   absorbed = NULL;
   radiance = NULL;
+  hierarchical = NULL;
   max_undistributed_patch = -1;
   total_area = -1;
 }
@@ -51,6 +57,9 @@ void Radiosity::Reset() {
   delete [] undistributed;
   delete [] absorbed;
   delete [] radiance;
+  // the hierarchy is rebuilt from scratch (the mesh may have changed)
+  delete hierarchical;
+  hierarchical = NULL;
 
   // create and fill the data structures
   num_faces = mesh->numFaces();
@@ -58,6 +67,10 @@ void Radiosity::Reset() {
   undistributed = new Vec3f[num_faces];
   absorbed = new Vec3f[num_faces];
   radiance = new Vec3f[num_faces];
+  emitted.resize(num_faces);
+  diffuse_r.resize(num_faces);
+  diffuse_g.resize(num_faces);
+  diffuse_b.resize(num_faces);
   for (int i = 0; i < num_faces; i++) {
     Face *f = mesh->getFace(i);
     f->setRadiosityPatchIndex(i);
@@ -66,10 +79,44 @@ void Radiosity::Reset() {
     setUndistributed(i,emit);
     setAbsorbed(i,Vec3f(0,0,0));
     setRadiance(i,emit);
+    emitted[i] = emit;
+    Vec3f diffuse = f->getMaterial()->getDiffuseColor();
+    diffuse_r[i] = diffuse.r();
+    diffuse_g[i] = diffuse.g();
+    diffuse_b[i] = diffuse.b();
   }
 
+  BuildVertexFaceTable();
+
   // find the patch with the most undistributed energy
   findMaxUndistributed();
+  num_iterations = 0;
+  ComputeAmbient();
+}
+
+void Radiosity::BuildVertexFaceTable() {
+  // count the patches touching each vertex, then fill in (CSR layout)
+  int num_vertices = mesh->numVertices();
+  vertex_face_start.assign(num_vertices+1,0);
+  patch_normal.resize(num_faces);
+  for (int i = 0; i < num_faces; i++) {
+    Face *f = mesh->getFace(i);
+    patch_normal[i] = f->computeNormal();
+    for (int j = 0; j < 4; j++) {
+      vertex_face_start[(*f)[j]->getIndex()+1]++;
+    }
+  }
+  for (int v = 0; v < num_vertices; v++) {
+    vertex_face_start[v+1] += vertex_face_start[v];
+  }
+  vertex_faces.resize(vertex_face_start[num_vertices]);
+  std::vector<int> next(vertex_face_start.begin(),vertex_face_start.end()-1);
+  for (int i = 0; i < num_faces; i++) {
+    Face *f = mesh->getFace(i);
+    for (int j = 0; j < 4; j++) {
+      vertex_faces[next[(*f)[j]->getIndex()]++] = i;
+    }
+  }
 }
 
 
@@ -79,19 +126,16 @@ void Radiosity::Reset() {
 void Radiosity::findMaxUndistributed() {
   // find the patch with the most undistributed energy 
   // don't forget that the patches may have different sizes!
-  max_undistributed_patch = -1;
-  total_undistributed = 0;
+  // the heap keeps track of this as Iterate changes the patches
+  std::vector<double> power(num_faces);
   total_area = 0;
-  double max = -1;
   for (int i = 0; i < num_faces; i++) {
-    double m = getUndistributed(i).Length() * getArea(i);
-    total_undistributed += m;
+    power[i] = getUndistributed(i).Length() * getArea(i);
     total_area += getArea(i);
-    if (max < m) {
-      max = m;
-      max_undistributed_patch = i;
-    }
   }
+  undistributed_heap.Initialize(power);
+  total_undistributed = undistributed_heap.getTotal();
+  max_undistributed_patch = undistributed_heap.Top();
   assert (max_undistributed_patch >= 0 && max_undistributed_patch < num_faces);
 }
 
@@ -101,6 +145,19 @@ void Radiosity::ComputeFormFactors() {
   assert (num_faces > 0);
   formfactors = new double[num_faces*num_faces];
 
+  // reuse the matrix from an earlier run with the same geometry
+  if (LoadFormFactors()) return;
+
+  if (args->form_factor_method == FORM_FACTOR_HEMICUBE) {
+    ComputeFormFactorsHemicube();
+    SaveFormFactors();
+    return;
+  }
+  if (args->form_factor_method == FORM_FACTOR_ANALYTIC) {
+    ComputeFormFactorsAnalytic();
+    SaveFormFactors();
+    return;
+  }
 
   int isPrint=false;
   // =====================================
@@ -182,66 +239,746 @@ void Radiosity::ComputeFormFactors() {
 	  isPrint=false;
   }
 
+  SaveFormFactors();
+}
+
+// ================================================================
+// HEMICUBE FORM FACTORS
+// ================================================================
+
+// each thread renders the hemicubes of every num_threads-th patch
+struct HemicubeVars {
+  int first, step;
+  int resolution;
+  const std::vector<HemicubePatch> *patches;
+  double *formfactors;
+};
+
+DWORD WINAPI HemicubeRows(void *arg) {
+  HemicubeVars *vars = (HemicubeVars*)arg;
+  Hemicube hemicube(vars->resolution);
+  int n = vars->patches->size();
+  for (int i = vars->first; i < n; i += vars->step) {
+    hemicube.ComputeRow(*vars->patches,i,vars->formfactors + (size_t)i*n);
+  }
+  return 0;
+}
+
+void Radiosity::ComputeFormFactorsHemicube() {
+  std::vector<HemicubePatch> patches(num_faces);
+  for (int i = 0; i < num_faces; i++) {
+    Face *f = mesh->getFace(i);
+    for (int k = 0; k < 4; k++) patches[i].verts[k] = (*f)[k]->get();
+    patches[i].normal = f->computeNormal();
+    patches[i].normal.Normalize();
+    patches[i].centroid = f->computeCentroid();
+  }
+
+  int num_threads = my_max(1,my_min(args->num_threads,num_faces));
+  std::vector<HemicubeVars> vars(num_threads);
+  std::vector<HANDLE> threads(num_threads);
+  for (int t = 0; t < num_threads; t++) {
+    vars[t].first = t;
+    vars[t].step = num_threads;
+    vars[t].resolution = args->hemicube_resolution;
+    vars[t].patches = &patches;
+    vars[t].formfactors = formfactors;
+    threads[t] = CreateThread(NULL, 0, HemicubeRows, &vars[t], 0, NULL);
+  }
+  WaitForMultipleObjects(num_threads, &threads[0], TRUE, INFINITE);
+  for (int t = 0; t < num_threads; t++) {
+    CloseHandle(threads[t]);
+  }
+  // unlike the ray cast estimate these are true form factors, a row
+  // only sums to less than 1 where part of the view sees no patch
+}
+
+// ================================================================
+// ANALYTIC FORM FACTORS
+// ================================================================
+
+// the unoccluded form factor from a differential area at p (facing n)
+// to a polygon, by the contour integral:
+//   F = 1/(2 pi) sum over the edges of angle(a,b) * n.(a x b)/|a x b|
+// where a & b are the directions to the two ends of the edge.  the
+// part of the polygon below the horizon of p is clipped off first.
+double PointToPolygonFormFactor(const Vec3f &p, const Vec3f &n, Face *f) {
+  Vec3f verts[8];
+  int num = 0;
+  for (int k = 0; k < 4; k++) {
+    Vec3f a = (*f)[k]->get() - p;
+    Vec3f b = (*f)[(k+1)%4]->get() - p;
+    double ha = a.Dot3(n);
+    double hb = b.Dot3(n);
+    if (ha > 0) verts[num++] = a;
+    if ((ha > 0) != (hb > 0)) {
+      double t = ha / (ha - hb);
+      verts[num++] = a + t*(b-a);
+    }
+  }
+  if (num < 3) return 0;
+  double sum = 0;
+  for (int k = 0; k < num; k++) {
+    Vec3f a = verts[k];
+    Vec3f b = verts[(k+1)%num];
+    a.Normalize();
+    b.Normalize();
+    Vec3f cross;
+    Vec3f::Cross3(cross,a,b);
+    double length = cross.Length();
+    if (length < 1e-12) continue;
+    double angle = atan2(length,a.Dot3(b));
+    sum += angle * n.Dot3(cross) / length;
+  }
+  return fabs(sum) / (2*M_PI);
+}
+
+// is the segment from a to b free of other geometry?
+bool SegmentVisible(RayTracer *raytracer, const Vec3f &a, const Vec3f &b) {
+  Vec3f dir = b - a;
+  double dist = dir.Length();
+  dir.Normalize();
+  Ray r(a,dir);
+  Hit h;
+  return !raytracer->CastRay(r,h,true) || h.getT() > dist - EPSILON;
+}
+
+// the fraction of the rays between two patches that aren't blocked.
+// the centroids & (pulled in) corners are tried first: if they all
+// agree the pair is taken to be fully visible or fully hidden and no
+// random samples are needed.
+double Radiosity::Visibility(Face *a, Face *b) {
+  Vec3f ca = a->computeCentroid();
+  Vec3f cb = b->computeCentroid();
+  int visible = SegmentVisible(raytracer,ca,cb);
+  int tests = 1;
+  for (int k = 0; k < 4; k++) {
+    Vec3f pa = ca + 0.9*((*a)[k]->get() - ca);
+    Vec3f pb = cb + 0.9*((*b)[k]->get() - cb);
+    visible += SegmentVisible(raytracer,pa,pb);
+    tests++;
+  }
+  if (visible == 0 || visible == tests) return visible / double(tests);
+  for (int k = 0; k < args->num_form_factor_samples; k++) {
+    visible += SegmentVisible(raytracer,a->RandomPoint(),b->RandomPoint());
+    tests++;
+  }
+  return visible / double(tests);
+}
+
+void Radiosity::ComputeFormFactorsAnalytic() {
+  for (int i = 0; i < num_faces; i++) {
+    Face *fi = mesh->getFace(i);
+    Vec3f ci = fi->computeCentroid();
+    Vec3f ni = fi->computeNormal();
+    ni.Normalize();
+    for (int j = 0; j < num_faces; j++) {
+      formfactors[i*num_faces+j] = 0;
+      if (i == j) continue;
+      Face *fj = mesh->getFace(j);
+      // j must face the centroid of i
+      if (fj->computeNormal().Dot3(ci - fj->computeCentroid()) <= 0) continue;
+      double f = PointToPolygonFormFactor(ci,ni,fj);
+      if (f <= 0) continue;
+      // only the visibility needs rays
+      formfactors[i*num_faces+j] = f * Visibility(fi,fj);
+    }
+  }
+  // like the hemicube, these rows are not normalized
+}
+
+// ================================================================
+// FORM FACTOR CACHE
+// ================================================================
+
+// The form factors only depend on the patch geometry and the sample
+// counts.  The file is a fixed size header followed by the raw n x n
+// matrix of doubles (so it can also be memory mapped).
+
+#define FORM_FACTOR_CACHE_VERSION 2
+
+struct FormFactorCacheHeader {
+  char magic[8];
+  unsigned long long hash;
+  int num_faces;
+  int version;
+};
+
+// 64 bit FNV-1a
+void HashBytes(unsigned long long &hash, const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+}
+
+unsigned long long FormFactorHash(Mesh *mesh, ArgParser *args) {
+  unsigned long long hash = 14695981039346656037ULL;
+  int params[3] = { FORM_FACTOR_CACHE_VERSION, mesh->numFaces(), args->form_factor_method };
+  HashBytes(hash,params,sizeof(params));
+  // only the settings the method reads, so e.g. a new shadow sample
+  // count doesn't throw away a hemicube matrix
+  if (args->form_factor_method == FORM_FACTOR_HEMICUBE) {
+    HashBytes(hash,&args->hemicube_resolution,sizeof(int));
+  } else if (args->form_factor_method == FORM_FACTOR_ANALYTIC) {
+    HashBytes(hash,&args->num_form_factor_samples,sizeof(int));
+  } else {
+    int samples[2] = { args->num_form_factor_samples, args->num_shadow_samples };
+    HashBytes(hash,samples,sizeof(samples));
+  }
+  // the patch corners (in patch order) cover both the scene and the
+  // subdivision level
+  for (int i = 0; i < mesh->numFaces(); i++) {
+    Face *f = mesh->getFace(i);
+    for (int j = 0; j < 4; j++) {
+      const Vec3f &v = (*f)[j]->get();
+      double xyz[3] = { v.x(), v.y(), v.z() };
+      HashBytes(hash,xyz,sizeof(xyz));
+    }
+  }
+  return hash;
+}
+
+std::string Radiosity::FormFactorCacheFile() const {
+  char name[64];
+  sprintf(name,"formfactors_%016llx.bin",FormFactorHash(mesh,args));
+  std::string directory = args->form_factor_cache;
+  if (directory.size() > 0 && directory[directory.size()-1] != '/' && directory[directory.size()-1] != '\\')
+    directory += "/";
+  return directory + name;
+}
+
+bool Radiosity::LoadFormFactors() {
+  if (args->form_factor_cache == NULL) return false;
+  std::string filename = FormFactorCacheFile();
+  FILE *file = fopen(filename.c_str(),"rb");
+  if (file == NULL) return false;
+  FormFactorCacheHeader header;
+  bool ok = (fread(&header,sizeof(header),1,file) == 1 &&
+             !strncmp(header.magic,"FORMFACT",8) &&
+             header.hash == FormFactorHash(mesh,args) &&
+             header.num_faces == num_faces &&
+             header.version == FORM_FACTOR_CACHE_VERSION);
+  size_t n = size_t(num_faces)*num_faces;
+  if (ok) ok = (fread(formfactors,sizeof(double),n,file) == n);
+  fclose(file);
+  if (ok) std::cout << "loaded form factors from " << filename << std::endl;
+  else std::cout << "WARNING: ignoring bad form factor cache " << filename << std::endl;
+  return ok;
+}
 
+void Radiosity::SaveFormFactors() const {
+  if (args->form_factor_cache == NULL) return;
+  std::string filename = FormFactorCacheFile();
+  FILE *file = fopen(filename.c_str(),"wb");
+  if (file == NULL) {
+    std::cout << "WARNING: cannot write form factor cache " << filename << std::endl;
+    return;
+  }
+  FormFactorCacheHeader header;
+  memcpy(header.magic,"FORMFACT",8);
+  header.hash = FormFactorHash(mesh,args);
+  header.num_faces = num_faces;
+  header.version = FORM_FACTOR_CACHE_VERSION;
+  size_t n = size_t(num_faces)*num_faces;
+  bool ok = (fwrite(&header,sizeof(header),1,file) == 1 &&
+             fwrite(formfactors,sizeof(double),n,file) == n);
+  fclose(file);
+  if (ok) std::cout << "saved form factors to " << filename << std::endl;
+  else std::cout << "WARNING: error writing form factor cache " << filename << std::endl;
 }
 
 // ================================================================
 // ================================================================
 
 double Radiosity::Iterate() {
+  if (args->hierarchical_radiosity)
+    return IterateHierarchical();
+
+  double residual = IterateShooting();
+  ComputeAmbient();
+  return residual;
+}
+
+double Radiosity::IterateShooting() {
+
   if (formfactors == NULL) 
 	  ComputeFormFactors();
   assert (formfactors != NULL);
 
+  if (args->radiosity_solver != RADIOSITY_SHOOTING)
+    return IterateGathering();
+  if (args->radiosity_batch > 1)
+    return IterateBatch();
 
   // ==========================================
   // ASSIGNMENT:  IMPLEMENT RADIOSITY ALGORITHM
   // ==========================================
-  double total=0;
-  double maxUn=0;
-  int maxind=0;
+  int shooter = max_undistributed_patch;
+  Vec3f shoot = undistributed[shooter];
   for (int i=0;i<num_faces;i++)
   {
-
-	  radiance[i]+=undistributed[max_undistributed_patch]*mesh->getFace(i)->getMaterial()->getDiffuseColor()*formfactors[max_undistributed_patch+i*num_faces];
-	  absorbed[i]+=undistributed[max_undistributed_patch]*(Vec3f(1,1,1)-mesh->getFace(i)->getMaterial()->getDiffuseColor())*formfactors[max_undistributed_patch+i*num_faces];
-	  undistributed[i]+=undistributed[max_undistributed_patch]*mesh->getFace(i)->getMaterial()->getDiffuseColor()*formfactors[max_undistributed_patch+i*num_faces];
-	  total+=undistributed[i].Length();
-	  if (undistributed[i].Length()>maxUn)
-	  {
-		  maxind = i;
-		  maxUn=undistributed[i].Length();
-	  }
+	  double f = formfactors[shooter+i*num_faces];
+	  if (f == 0) continue;
+	  Vec3f diffuse(diffuse_r[i],diffuse_g[i],diffuse_b[i]);
+	  radiance[i]+=shoot*diffuse*f;
+	  absorbed[i]+=shoot*(Vec3f(1,1,1)-diffuse)*f;
+	  undistributed[i]+=shoot*diffuse*f;
+	  undistributed_heap.Update(i,undistributed[i].Length()*area[i]);
   }
-  undistributed[max_undistributed_patch].Scale(0);
-  max_undistributed_patch=maxind;
-  // return the total light yet undistributed
+  undistributed[shooter].Scale(0);
+  undistributed_heap.Update(shooter,0);
+  max_undistributed_patch = undistributed_heap.Top();
+  total_undistributed = my_max(0.0,undistributed_heap.getTotal());
+  num_iterations++;
+  // return the light yet undistributed, per unit area of the scene
   // (so we can decide when the solution has sufficiently converged)
-  return total;
+  return total_undistributed / total_area;
+}
+
+
+// ================================================================
+// BATCHED SHOOTING
+// ================================================================
+
+// each thread updates a range of receivers from all the shooters of
+// the batch.  all per patch data is in flat arrays, one per channel.
+struct BatchVars {
+  int begin, end;
+  int num_faces;
+  int num_shooters;
+  const int *shooters;
+  const float *shoot_r, *shoot_g, *shoot_b;
+  const float *diffuse_r, *diffuse_g, *diffuse_b;
+  const double *formfactors;
+  Vec3f *radiance, *absorbed, *undistributed;
+};
+
+DWORD WINAPI ShootBatch(void *arg) {
+  BatchVars *vars = (BatchVars*)arg;
+  int k = vars->num_shooters;
+  std::vector<float> f(k);
+  for (int i = vars->begin; i < vars->end; i++) {
+    // gather this receiver's form factors to the shooters, then the
+    // sums are straight loops the compiler can vectorize
+    const double *row = vars->formfactors + (size_t)i*vars->num_faces;
+    for (int s = 0; s < k; s++) f[s] = (float)row[vars->shooters[s]];
+    float r = 0, g = 0, b = 0;
+    for (int s = 0; s < k; s++) {
+      r += f[s] * vars->shoot_r[s];
+      g += f[s] * vars->shoot_g[s];
+      b += f[s] * vars->shoot_b[s];
+    }
+    if (r == 0 && g == 0 && b == 0) continue;
+    Vec3f incoming(r,g,b);
+    Vec3f reflected(vars->diffuse_r[i]*r, vars->diffuse_g[i]*g, vars->diffuse_b[i]*b);
+    vars->radiance[i] += reflected;
+    vars->absorbed[i] += incoming - reflected;
+    vars->undistributed[i] += reflected;
+  }
+  return 0;
+}
+
+// shoot from the radiosity_batch patches with the most undistributed
+// light at once, with the receivers split across threads
+double Radiosity::IterateBatch() {
+  std::vector<int> shooters;
+  std::vector<float> shoot_r, shoot_g, shoot_b;
+  for (int k = 0; k < args->radiosity_batch; k++) {
+    int s = undistributed_heap.Top();
+    if (undistributed_heap.getKey(s) <= 0) break;
+    shooters.push_back(s);
+    shoot_r.push_back(undistributed[s].r());
+    shoot_g.push_back(undistributed[s].g());
+    shoot_b.push_back(undistributed[s].b());
+    undistributed[s] = Vec3f(0,0,0);
+    undistributed_heap.Update(s,0);
+  }
+
+  if (!shooters.empty()) {
+    int num_threads = my_max(1,my_min(args->num_threads,num_faces));
+    std::vector<BatchVars> vars(num_threads);
+    std::vector<HANDLE> threads(num_threads);
+    for (int t = 0; t < num_threads; t++) {
+      BatchVars &v = vars[t];
+      v.begin = (num_faces * t) / num_threads;
+      v.end = (num_faces * (t+1)) / num_threads;
+      v.num_faces = num_faces;
+      v.num_shooters = shooters.size();
+      v.shooters = &shooters[0];
+      v.shoot_r = &shoot_r[0];
+      v.shoot_g = &shoot_g[0];
+      v.shoot_b = &shoot_b[0];
+      v.diffuse_r = &diffuse_r[0];
+      v.diffuse_g = &diffuse_g[0];
+      v.diffuse_b = &diffuse_b[0];
+      v.formfactors = formfactors;
+      v.radiance = radiance;
+      v.absorbed = absorbed;
+      v.undistributed = undistributed;
+      threads[t] = CreateThread(NULL, 0, ShootBatch, &v, 0, NULL);
+    }
+    WaitForMultipleObjects(num_threads, &threads[0], TRUE, INFINITE);
+    for (int t = 0; t < num_threads; t++) {
+      CloseHandle(threads[t]);
+    }
+    // the heap isn't thread safe, update it afterwards
+    for (int i = 0; i < num_faces; i++) {
+      undistributed_heap.Update(i,undistributed[i].Length()*area[i]);
+    }
+  }
+
+  max_undistributed_patch = undistributed_heap.Top();
+  total_undistributed = my_max(0.0,undistributed_heap.getTotal());
+  num_iterations++;
+  return total_undistributed / total_area;
+}
+
+// ================================================================
+// GATHERING SOLVERS (JACOBI & GAUSS-SEIDEL)
+// ================================================================
+
+// B_i = E_i + rho_i * sum_j F_ij B_j, one sweep over all the patches.
+// Each thread updates a block of patches.  Jacobi only reads the
+// previous sweep, the blocked Gauss-Seidel also reads the values
+// already updated in its own block.
+struct SweepVars {
+  int begin, end;
+  int num_faces;
+  bool gauss_seidel;
+  double overshoot;
+  const double *formfactors;
+  const double *area;
+  const Vec3f *emitted;
+  const float *diffuse_r, *diffuse_g, *diffuse_b;
+  const Vec3f *old_radiance;
+  Vec3f *radiance, *absorbed, *undistributed;
+  double residual;
+};
+
+DWORD WINAPI GatherSweep(void *arg) {
+  SweepVars *vars = (SweepVars*)arg;
+  const Vec3f *inside = vars->gauss_seidel ? vars->radiance : vars->old_radiance;
+  vars->residual = 0;
+  for (int i = vars->begin; i < vars->end; i++) {
+    const double *row = vars->formfactors + (size_t)i*vars->num_faces;
+    double r = 0, g = 0, b = 0;
+    for (int j = 0; j < vars->num_faces; j++) {
+      if (row[j] == 0) continue;
+      const Vec3f &bj = (j >= vars->begin && j < vars->end) ? inside[j] : vars->old_radiance[j];
+      r += row[j] * bj.r();
+      g += row[j] * bj.g();
+      b += row[j] * bj.b();
+    }
+    Vec3f incoming(r,g,b);
+    Vec3f diffuse(vars->diffuse_r[i],vars->diffuse_g[i],vars->diffuse_b[i]);
+    Vec3f target = vars->emitted[i] + diffuse * incoming;
+    Vec3f change = target - vars->old_radiance[i];
+    vars->radiance[i] = vars->old_radiance[i] + vars->overshoot * change;
+    vars->absorbed[i] = (Vec3f(1,1,1)-diffuse) * incoming;
+    // the light picked up this sweep is what is still "unshot"
+    vars->undistributed[i] = change;
+    vars->residual += change.Length() * vars->area[i];
+  }
+  return 0;
+}
+
+double Radiosity::IterateGathering() {
+  std::vector<Vec3f> old_radiance(radiance,radiance+num_faces);
+  int num_threads = my_max(1,my_min(args->num_threads,num_faces));
+  std::vector<SweepVars> vars(num_threads);
+  std::vector<HANDLE> threads(num_threads);
+  for (int t = 0; t < num_threads; t++) {
+    SweepVars &v = vars[t];
+    v.begin = (num_faces * t) / num_threads;
+    v.end = (num_faces * (t+1)) / num_threads;
+    v.num_faces = num_faces;
+    v.gauss_seidel = (args->radiosity_solver == RADIOSITY_GAUSS_SEIDEL);
+    v.overshoot = args->overshoot;
+    v.formfactors = formfactors;
+    v.area = area;
+    v.emitted = &emitted[0];
+    v.diffuse_r = &diffuse_r[0];
+    v.diffuse_g = &diffuse_g[0];
+    v.diffuse_b = &diffuse_b[0];
+    v.old_radiance = &old_radiance[0];
+    v.radiance = radiance;
+    v.absorbed = absorbed;
+    v.undistributed = undistributed;
+    threads[t] = CreateThread(NULL, 0, GatherSweep, &v, 0, NULL);
+  }
+  WaitForMultipleObjects(num_threads, &threads[0], TRUE, INFINITE);
+  double residual = 0;
+  for (int t = 0; t < num_threads; t++) {
+    CloseHandle(threads[t]);
+    residual += vars[t].residual;
+  }
+  residual /= total_area;
+  num_iterations++;
+  return residual;
+}
+
+// ================================================================
+// INCREMENTAL CHANGES
+// ================================================================
+
+// add light to a patch as if it had just been received & reflected,
+// it still has to be distributed to the rest of the scene
+void Radiosity::AddToSolution(int i, const Vec3f &delta) {
+  radiance[i] += delta;
+  undistributed[i] += delta;
+  // (the difference can be negative, the heap orders by magnitude)
+  undistributed_heap.Update(i,undistributed[i].Length()*area[i]);
+  max_undistributed_patch = undistributed_heap.Top();
+  total_undistributed = my_max(0.0,undistributed_heap.getTotal());
+  ComputeAmbient();
 }
 
+void Radiosity::setPatchEmission(int i, const Vec3f &e) {
+  assert (i >= 0 && i < num_faces);
+  assert (!args->hierarchical_radiosity);
+  Vec3f delta = e - emitted[i];
+  emitted[i] = e;
+  AddToSolution(i,delta);
+}
+
+// the light patch i has received so far: what every patch has sent out
+// (its radiance less what it has yet to distribute) times the form
+// factor.  exact for shooting, and the last sweep's gather for the
+// gathering solvers (which recompute it on the next sweep anyway)
+Vec3f Radiosity::ReceivedLight(int i) const {
+  Vec3f received(0,0,0);
+  if (formfactors == NULL) return received;
+  const double *row = formfactors + (size_t)i*num_faces;
+  for (int j = 0; j < num_faces; j++) {
+    if (row[j] == 0) continue;
+    received += row[j] * (radiance[j] - undistributed[j]);
+  }
+  return received;
+}
+
+void Radiosity::setPatchReflectance(int i, const Vec3f &rho) {
+  assert (i >= 0 && i < num_faces);
+  assert (!args->hierarchical_radiosity);
+  Vec3f received = ReceivedLight(i);
+  Vec3f old_rho(diffuse_r[i],diffuse_g[i],diffuse_b[i]);
+  diffuse_r[i] = rho.r();
+  diffuse_g[i] = rho.g();
+  diffuse_b[i] = rho.b();
+  Vec3f delta = (rho - old_rho) * received;
+  absorbed[i] = (Vec3f(1,1,1) - rho) * received;
+  AddToSolution(i,delta);
+}
+
+// the patches subdivided from an original light quad: those whose
+// centroid lies in the quad
+void Radiosity::getLightPatches(int light, std::vector<int> &patches) const {
+  assert (light >= 0 && light < (int)mesh->getLights().size());
+  Face *l = mesh->getLights()[light];
+  Vec3f normal = l->computeNormal();
+  normal.Normalize();
+  for (int i = 0; i < num_faces; i++) {
+    Vec3f c = mesh->getFace(i)->computeCentroid();
+    if (fabs(normal.Dot3(c - (*l)[0]->get())) > EPSILON) continue;
+    bool inside = true;
+    for (int k = 0; k < 4 && inside; k++) {
+      Vec3f edge = (*l)[(k+1)%4]->get() - (*l)[k]->get();
+      Vec3f cross;
+      Vec3f::Cross3(cross,edge,c - (*l)[k]->get());
+      inside = (cross.Dot3(normal) >= 0);
+    }
+    if (inside) patches.push_back(i);
+  }
+}
+
+// ================================================================
+// AMBIENT CORRECTION
+// ================================================================
+
+// The light not yet distributed will, on average, bounce around the
+// scene 1/(1-rho_avg) times.  Spread that over every patch so early
+// solutions aren't too dark (Cohen et al. 1988).
+void Radiosity::ComputeAmbient() {
+  Vec3f rho_avg(0,0,0);
+  Vec3f unshot(0,0,0);
+  for (int i = 0; i < num_faces; i++) {
+    rho_avg += area[i] * Vec3f(diffuse_r[i],diffuse_g[i],diffuse_b[i]);
+    unshot += area[i] * undistributed[i];
+  }
+  rho_avg /= total_area;
+  unshot /= total_area;
+  ambient = Vec3f(unshot.r() / (1 - my_min(rho_avg.r(),0.99)),
+                  unshot.g() / (1 - my_min(rho_avg.g(),0.99)),
+                  unshot.b() / (1 - my_min(rho_avg.b(),0.99)));
+}
+
+Vec3f Radiosity::getDisplayRadiance(int i) const {
+  if (!args->ambient_correction) return getRadiance(i);
+  return getRadiance(i) + Vec3f(diffuse_r[i],diffuse_g[i],diffuse_b[i]) * ambient;
+}
+
+// the hierarchical solver works on its own quadtrees, copy its answer
+// to the patches of the mesh for display
+double Radiosity::IterateHierarchical() {
+  if (hierarchical == NULL)
+    hierarchical = new HierarchicalRadiosity(mesh,args,raytracer);
+  double change = hierarchical->Iterate();
+  // the hierarchical solver gathers, it has no undistributed or
+  // absorbed light to report
+  for (int i = 0; i < num_faces; i++) {
+    setRadiance(i,hierarchical->getPatchRadiance(i));
+    setAbsorbed(i,Vec3f(0,0,0));
+    setUndistributed(i,Vec3f(0,0,0));
+  }
+  num_iterations++;
+  return change;
+}
+
+
+// ================================================================
+// ADAPTIVE SUBDIVISION
+// ================================================================
+
+// a point lies in the shadow of the light if something blocks the
+// path to the light's center
+bool VisibleFromLight(RayTracer *raytracer, const Vec3f &p, Face *light) {
+  Vec3f dir = light->computeCentroid() - p;
+  double dist = dir.Length();
+  dir.Normalize();
+  Ray r(p,dir);
+  Hit h;
+  return !raytracer->CastRay(r,h,true) || h.getT() > dist - EPSILON;
+}
+
+void Radiosity::ComputeRefinementFlags(std::vector<bool> &refine) {
+  refine.assign(num_faces,false);
+  std::vector<Face*> &lights = mesh->getLights();
+  // the rasterized primitive faces come last and are never split
+  int num_quads = mesh->numFaces() - mesh->numRasterizedPrimitiveFaces();
+  int num_gradient = 0;
+  int num_shadow = 0;
+  for (int i = 0; i < num_quads; i++) {
+    Face *f = mesh->getFace(i);
+    Vec3f normal = f->computeNormal();
+
+    // large radiance difference with a (coplanar) neighbor, including
+    // a coarser neighbor on the other side of a T-junction
+    Vec3f b = getRadiance(i);
+    Edge *e = f->getEdge();
+    for (int j = 0; j < 4 && !refine[i]; j++, e = e->getNext()) {
+      Edge *other = e->getOpposite();
+      if (other == NULL) other = mesh->getCoarseEdge(e);
+      if (other == NULL) continue;
+      Face *f2 = other->getFace();
+      if (normal.Dot3(f2->computeNormal()) < 0.5) continue;
+      Vec3f b2 = getRadiance(f2->getRadiosityPatchIndex());
+      double m = my_max(b.Length(),b2.Length());
+      if (m > 0 && (b-b2).Length() > args->adaptive_threshold * m) {
+        refine[i] = true;
+        num_gradient++;
+      }
+    }
+    if (refine[i]) continue;
+    if (f->getMaterial()->getEmittedColor().Length() > 0) continue;
+
+    // shadow boundary: the light is visible from some of the patch
+    // (the center & points just inside the corners) but not all of it
+    Vec3f centroid = f->computeCentroid();
+    for (unsigned int l = 0; l < lights.size() && !refine[i]; l++) {
+      int visible = VisibleFromLight(raytracer,centroid,lights[l]);
+      for (int k = 0; k < 4; k++) {
+        Vec3f corner = 0.9*(*f)[k]->get() + 0.1*centroid;
+        visible += VisibleFromLight(raytracer,corner,lights[l]);
+      }
+      if (visible > 0 && visible < 5) {
+        refine[i] = true;
+        num_shadow++;
+      }
+    }
+  }
+  std::cout << " refine: " << num_gradient << " patches with large gradients, "
+            << num_shadow << " on shadow boundaries" << std::endl;
+}
 
 // =======================================================================================
 // VBO & DISPLAY FUNCTIONS
 // =======================================================================================
 
-// for interpolation
-void CollectFacesWithVertex(Vertex *have, Face *f, std::vector<Face*> &faces) {
-  for (unsigned int i = 0; i < faces.size(); i++) {
-    if (faces[i] == f) return;
+Vec3f Radiosity::InterpolatedRadiance(Face *f, Vertex *v, const std::vector<Vec3f> *values) {
+  // a hanging vertex (the midpoint of a coarser neighbor's edge) takes
+  // the value the neighbor will interpolate there, so the shading
+  // doesn't jump across the T-junction
+  Edge *e = f->getEdge();
+  for (int j = 0; j < 4; j++, e = e->getNext()) {
+    if (e->getStartVertex() != v && e->getEndVertex() != v) continue;
+    Edge *coarse = mesh->getCoarseEdge(e);
+    if (coarse == NULL) continue;
+    Vertex *a = coarse->getStartVertex();
+    Vertex *b = coarse->getEndVertex();
+    if (mesh->getChildVertex(a,b) != v) continue;
+    return 0.5 * (InterpolatedRadiance(coarse->getFace(),a,values) +
+                  InterpolatedRadiance(coarse->getFace(),b,values));
+  }
+  // average the patches around the vertex facing the same way
+  double total = 0;
+  Vec3f color = Vec3f(0,0,0);
+  const Vec3f &normal = patch_normal[f->getRadiosityPatchIndex()];
+  int v_index = v->getIndex();
+  for (int k = vertex_face_start[v_index]; k < vertex_face_start[v_index+1]; k++) {
+    int p = vertex_faces[k];
+    if (normal.Dot3(patch_normal[p]) < 0.5) continue;
+    assert (area[p] > 0);
+    total += area[p];
+    color += area[p] * (values ? (*values)[p] : getDisplayRadiance(p));
+  }
+  assert (total > 0);
+  color /= total;
+  return color;
+}
+
+// ================================================================
+// INDIRECT LIGHT FOR THE RAY TRACER
+// ================================================================
+
+void Radiosity::PrepareIndirect() {
+  if (formfactors == NULL) ComputeFormFactors();
+  // the light reaching each patch after at least one bounce: gather
+  // what the other patches reflect, leaving out what they emit (the
+  // ray tracer handles direct light with shadow rays)
+  std::vector<Vec3f> indirect(num_faces);
+  std::vector<Vec3f> reflected(num_faces);
+  for (int j = 0; j < num_faces; j++) {
+    reflected[j] = getDisplayRadiance(j) - emitted[j];
   }
-  if (have != (*f)[0] && have != (*f)[1] && have != (*f)[2] && have != (*f)[3]) return;
-  faces.push_back(f);
-  for (int i = 0; i < 4; i++) {
-    Edge *ea = f->getEdge()->getOpposite();
-    Edge *eb = f->getEdge()->getNext()->getOpposite();
-    Edge *ec = f->getEdge()->getNext()->getNext()->getOpposite();
-    Edge *ed = f->getEdge()->getNext()->getNext()->getNext()->getOpposite();
-    if (ea != NULL) CollectFacesWithVertex(have,ea->getFace(),faces);
-    if (eb != NULL) CollectFacesWithVertex(have,eb->getFace(),faces);
-    if (ec != NULL) CollectFacesWithVertex(have,ec->getFace(),faces);
-    if (ed != NULL) CollectFacesWithVertex(have,ed->getFace(),faces);
+  for (int i = 0; i < num_faces; i++) {
+    const double *row = formfactors + (size_t)i*num_faces;
+    Vec3f sum(0,0,0);
+    for (int j = 0; j < num_faces; j++) {
+      if (row[j] != 0) sum += row[j] * reflected[j];
+    }
+    indirect[i] = sum;
   }
+  indirect_corners.resize(4*num_faces);
+  for (int i = 0; i < num_faces; i++) {
+    Face *f = mesh->getFace(i);
+    for (int k = 0; k < 4; k++) {
+      indirect_corners[4*i+k] = args->interpolate ?
+        InterpolatedRadiance(f,(*f)[k],&indirect) : indirect[i];
+    }
+  }
+  patch_grid.Build(mesh);
+}
+
+Vec3f Radiosity::IndirectIrradiance(const Vec3f &p, const Vec3f &normal) const {
+  double weights[4];
+  int i = patch_grid.Locate(p,normal,weights);
+  if (i < 0 || 4*i >= (int)indirect_corners.size()) return args->ambient_light;
+  Vec3f answer(0,0,0);
+  for (int k = 0; k < 4; k++) {
+    answer += weights[k] * indirect_corners[4*i+k];
+  }
+  return answer;
 }
 
 // different visualization modes
@@ -251,30 +988,15 @@ Vec3f Radiosity::setupHelperForColor(Face *f, int i, int j) {
   if (args->render_mode == RENDER_MATERIALS) {
     return f->getMaterial()->getDiffuseColor();
   } else if (args->render_mode == RENDER_RADIANCE && args->interpolate == true) {
-    std::vector<Face*> faces;
-    CollectFacesWithVertex((*f)[j],f,faces);
-    double total = 0;
-    Vec3f color = Vec3f(0,0,0);
-    Vec3f normal = f->computeNormal();
-    for (unsigned int i = 0; i < faces.size(); i++) {
-      Vec3f normal2 = faces[i]->computeNormal();
-      double area = faces[i]->getArea();
-      if (normal.Dot3(normal2) < 0.5) continue;
-      assert (area > 0);
-      total += area;
-      color += area * getRadiance(faces[i]->getRadiosityPatchIndex());
-    }
-    assert (total > 0);
-    color /= total;
-    return color;
+    return InterpolatedRadiance(f,(*f)[j]);
   } else if (args->render_mode == RENDER_LIGHTS) {
-    return f->getMaterial()->getEmittedColor();
+    return getPatchEmission(i);
   } else if (args->render_mode == RENDER_UNDISTRIBUTED) { 
     return getUndistributed(i);
   } else if (args->render_mode == RENDER_ABSORBED) {
     return getAbsorbed(i);
   } else if (args->render_mode == RENDER_RADIANCE) {
-    return getRadiance(i);
+    return getDisplayRadiance(i);
   } else if (args->render_mode == RENDER_FORM_FACTORS) {
     if (formfactors == NULL) ComputeFormFactors();
     double scale = 0.2 * total_area/getArea(i);
@@ -290,6 +1012,7 @@ Vec3f Radiosity::setupHelperForColor(Face *f, int i, int j) {
 void Radiosity::initializeVBOs() {
   // create a pointer for the vertex & index VBOs
   glGenBuffers(1, &mesh_quad_verts_VBO);
+  glGenBuffers(1, &mesh_quad_colors_VBO);
   glGenBuffers(1, &mesh_quad_indices_VBO);
   glGenBuffers(1, &mesh_textured_quad_indices_VBO);
   glGenBuffers(1, &mesh_interior_edge_indices_VBO);
@@ -313,11 +1036,7 @@ void Radiosity::setupVBOs() {
     for (int j = 0; j < 4; j++) {
       Vec3f pos = ((*f)[j])->get();
       Vec3f normal = f->computeNormal();
-      Vec3f color = setupHelperForColor(f,i,j);
-      color = Vec3f(linear_to_srgb(color.r()),
-		    linear_to_srgb(color.g()),
-		    linear_to_srgb(color.b()));
-      mesh_quad_verts.push_back(VBOPosNormalColorTexture(pos,normal,color,(*f)[j]->get_s(),(*f)[j]->get_t()));
+      mesh_quad_verts.push_back(VBOPosNormalTexture(pos,normal,(*f)[j]->get_s(),(*f)[j]->get_t()));
       if (e->getOpposite() == NULL) { 
 	mesh_border_edge_indices.push_back(VBOIndexedEdge(i*4+j,i*4+(j+1)%4));
       } else if (e->getStartVertex()->getIndex() < e->getEndVertex()->getIndex()) {
@@ -340,6 +1059,7 @@ void Radiosity::setupVBOs() {
   }
   assert ((int)mesh_quad_verts.size() == num_faces*4);
   assert ((int)mesh_quad_indices.size() + (int)mesh_textured_quad_indices.size() == num_faces);
+  setupColors();
 
   // cleanup old buffer data (if any)
   cleanupVBOs();
@@ -347,9 +1067,14 @@ void Radiosity::setupVBOs() {
   // copy the data to each VBO
   glBindBuffer(GL_ARRAY_BUFFER,mesh_quad_verts_VBO); 
   glBufferData(GL_ARRAY_BUFFER,
-	       sizeof(VBOPosNormalColorTexture) * num_faces * 4,
+	       sizeof(VBOPosNormalTexture) * num_faces * 4,
 	       &mesh_quad_verts[0],
 	       GL_STATIC_DRAW); 
+  glBindBuffer(GL_ARRAY_BUFFER,mesh_quad_colors_VBO); 
+  glBufferData(GL_ARRAY_BUFFER,
+	       sizeof(VBOColor) * num_faces * 4,
+	       &mesh_quad_colors[0],
+	       GL_DYNAMIC_DRAW); 
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mesh_quad_indices_VBO); 
   glBufferData(GL_ELEMENT_ARRAY_BUFFER,
 	       sizeof(VBOIndexedQuad) * mesh_quad_indices.size(),
@@ -386,6 +1111,38 @@ void Radiosity::setupVBOs() {
 }
 
 
+void Radiosity::setupColors() {
+  int num_faces = mesh->numFaces();
+  mesh_quad_colors.resize(num_faces*4);
+  for (int i = 0; i < num_faces; i++) {
+    Face *f = mesh->getFace(i);
+    for (int j = 0; j < 4; j++) {
+      Vec3f color = setupHelperForColor(f,i,j);
+      color = Vec3f(linear_to_srgb(color.r()),
+		    linear_to_srgb(color.g()),
+		    linear_to_srgb(color.b()));
+      mesh_quad_colors[i*4+j] = VBOColor(color);
+    }
+  }
+}
+
+
+void Radiosity::updateColorVBOs() {
+  // the form factor visualization also outlines the current shooter,
+  // and a changed mesh needs everything, so do the full setup
+  if (args->render_mode == RENDER_FORM_FACTORS ||
+      (int)mesh_quad_verts.size() != mesh->numFaces()*4) {
+    setupVBOs();
+    return;
+  }
+  setupColors();
+  glBindBuffer(GL_ARRAY_BUFFER,mesh_quad_colors_VBO); 
+  glBufferSubData(GL_ARRAY_BUFFER,0,
+		  sizeof(VBOColor) * mesh_quad_colors.size(),
+		  &mesh_quad_colors[0]);
+}
+
+
 void Radiosity::drawVBOs() {
   // =====================
   // DRAW ALL THE POLYGONS
@@ -399,13 +1156,14 @@ void Radiosity::drawVBOs() {
   int num_faces = mesh->numFaces();
   assert ((int)mesh_quad_indices.size() + (int)mesh_textured_quad_indices.size() == num_faces);
 
+  glBindBuffer(GL_ARRAY_BUFFER, mesh_quad_colors_VBO);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glColorPointer(3, GL_FLOAT, sizeof(VBOColor), BUFFER_OFFSET(0));
   glBindBuffer(GL_ARRAY_BUFFER, mesh_quad_verts_VBO);
   glEnableClientState(GL_VERTEX_ARRAY);
-  glVertexPointer(3, GL_FLOAT, sizeof(VBOPosNormalColorTexture), BUFFER_OFFSET(0));
+  glVertexPointer(3, GL_FLOAT, sizeof(VBOPosNormalTexture), BUFFER_OFFSET(0));
   glEnableClientState(GL_NORMAL_ARRAY);
-  glNormalPointer(GL_FLOAT, sizeof(VBOPosNormalColorTexture), BUFFER_OFFSET(12));
-  glEnableClientState(GL_COLOR_ARRAY);
-  glColorPointer(3, GL_FLOAT, sizeof(VBOPosNormalColorTexture), BUFFER_OFFSET(24));
+  glNormalPointer(GL_FLOAT, sizeof(VBOPosNormalTexture), BUFFER_OFFSET(12));
 
   // draw non textured faces
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_quad_indices_VBO);
@@ -418,7 +1176,7 @@ void Radiosity::drawVBOs() {
   if (args->render_mode == RENDER_MATERIALS) {
     glEnable(GL_TEXTURE_2D);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-    glTexCoordPointer( 2, GL_FLOAT, sizeof(VBOPosNormalColorTexture), BUFFER_OFFSET(36));
+    glTexCoordPointer( 2, GL_FLOAT, sizeof(VBOPosNormalTexture), BUFFER_OFFSET(24));
   }
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_textured_quad_indices_VBO);
   glDrawElements(GL_QUADS, 
@@ -446,7 +1204,7 @@ void Radiosity::drawVBOs() {
       glColor3f(0,0,0);
       glBindBuffer(GL_ARRAY_BUFFER, mesh_quad_verts_VBO);
       glEnableClientState(GL_VERTEX_ARRAY);
-      glVertexPointer(3, GL_FLOAT, sizeof(VBOPosNormalColorTexture), BUFFER_OFFSET(0));
+      glVertexPointer(3, GL_FLOAT, sizeof(VBOPosNormalTexture), BUFFER_OFFSET(0));
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_interior_edge_indices_VBO);
       glDrawElements(GL_LINES, mesh_interior_edge_indices.size()*2, GL_UNSIGNED_INT, 0);
       glDisableClientState(GL_VERTEX_ARRAY);
@@ -456,7 +1214,7 @@ void Radiosity::drawVBOs() {
       glColor3f(1,0,0);
       glBindBuffer(GL_ARRAY_BUFFER, mesh_quad_verts_VBO);
       glEnableClientState(GL_VERTEX_ARRAY);
-      glVertexPointer(3, GL_FLOAT, sizeof(VBOPosNormalColorTexture), BUFFER_OFFSET(0));
+      glVertexPointer(3, GL_FLOAT, sizeof(VBOPosNormalTexture), BUFFER_OFFSET(0));
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_border_edge_indices_VBO);
       glDrawElements(GL_LINES, mesh_border_edge_indices.size()*2, GL_UNSIGNED_INT, 0);
       glDisableClientState(GL_VERTEX_ARRAY);
@@ -468,6 +1226,7 @@ void Radiosity::drawVBOs() {
 
 void Radiosity::cleanupVBOs() {
   glDeleteBuffers(1, &mesh_quad_verts_VBO);
+  glDeleteBuffers(1, &mesh_quad_colors_VBO);
   glDeleteBuffers(1, &mesh_quad_indices_VBO);
   glDeleteBuffers(1, &mesh_textured_quad_indices_VBO);
   glDeleteBuffers(1, &mesh_interior_edge_indices_VBO);
@@ -2,15 +2,19 @@
 #define _RADIOSITY_H_
 
 #include <vector>
+#include <string>
 #include "vectors.h"
 #include "argparser.h"
 #include "vbo_structs.h"
+#include "indexed_heap.h"
+#include "patch_grid.h"
 
 class Mesh;
 class Face;
 class Vertex;
 class RayTracer;
 class PhotonMapping;
+class HierarchicalRadiosity;
 
 // ====================================================================
 // ====================================================================
@@ -28,11 +32,23 @@ public:
   void Reset();
   void Cleanup();
   void ComputeFormFactors();
+  // flag the patches that should be split by Mesh::AdaptiveSubdivision
+  void ComputeRefinementFlags(std::vector<bool> &refine);
   void setRayTracer(RayTracer *r) { raytracer = r; }
   void setPhotonMapping(PhotonMapping *pm) { photon_mapping = pm; }
 
+  // for -radiosity_indirect: gather the light arriving at every patch
+  // from the other (non-emitting) patches and index the patches.  call
+  // before ray tracing a frame, it is not thread safe.
+  void PrepareIndirect();
+  // the indirect irradiance at a ray hit, interpolated from the corners
+  // of the patch under it (safe to call from the render threads)
+  Vec3f IndirectIrradiance(const Vec3f &p, const Vec3f &normal) const;
+
   void initializeVBOs(); 
   void setupVBOs(); 
+  // recompute & upload only the colors (the geometry hasn't changed)
+  void updateColorVBOs();
   void drawVBOs();
   void cleanupVBOs();
 
@@ -57,9 +73,14 @@ public:
   Vec3f getRadiance(int i) const {
     assert (i >= 0 && i < num_faces);
     return radiance[i]; }
+  // sum over the patches of undistributed energy * area
+  double getTotalUndistributed() const { return total_undistributed; }
+  int numIterations() const { return num_iterations; }
   
   // =========
   // MODIFIERS
+  // one step of the selected solver, returns its residual (the caller
+  // reports it)
   double Iterate();
   void setFormFactor(int i, int j, double value) { 
     assert (i >= 0 && i < num_faces);
@@ -88,8 +109,42 @@ public:
     assert (i >= 0 && i < num_faces);
     radiance[i] = value; }
 
+  // change the emission or the diffuse reflectance of one patch
+  // (overriding its material) and push just the difference in light
+  // into the current solution.  the form factors stay valid, so the
+  // next few iterations only have to distribute the change.
+  // (not for the hierarchical solver, which reads the materials)
+  void setPatchEmission(int i, const Vec3f &e);
+  void setPatchReflectance(int i, const Vec3f &rho);
+  // the patches that make up light number `light` of the mesh
+  void getLightPatches(int light, std::vector<int> &patches) const;
+  Vec3f getPatchEmission(int i) const {
+    assert (i >= 0 && i < num_faces);
+    return emitted[i]; }
+  Vec3f getPatchReflectance(int i) const {
+    assert (i >= 0 && i < num_faces);
+    return Vec3f(diffuse_r[i],diffuse_g[i],diffuse_b[i]); }
+
 private:
   Vec3f setupHelperForColor(Face *f, int i, int j);
+  void setupColors();
+  // interpolate values (one per patch, NULL for the displayed radiance)
+  Vec3f InterpolatedRadiance(Face *f, Vertex *v, const std::vector<Vec3f> *values = NULL);
+  double IterateShooting();
+  double IterateHierarchical();
+  double IterateBatch();
+  double IterateGathering();
+  void ComputeAmbient();
+  Vec3f getDisplayRadiance(int i) const;
+  void AddToSolution(int i, const Vec3f &delta);
+  Vec3f ReceivedLight(int i) const;
+  void BuildVertexFaceTable();
+  void ComputeFormFactorsHemicube();
+  void ComputeFormFactorsAnalytic();
+  double Visibility(Face *a, Face *b);
+  std::string FormFactorCacheFile() const;
+  bool LoadFormFactors();
+  void SaveFormFactors() const;
 
   // ==============
   // REPRESENTATION
@@ -99,6 +154,9 @@ private:
   RayTracer *raytracer;
   PhotonMapping *photon_mapping;
 
+  // alternative solver, only created with -hierarchical_radiosity
+  HierarchicalRadiosity *hierarchical;
+
   // a nxn matrix
   // F_i,j radiant energy leaving i arriving at j
   double *formfactors;
@@ -111,15 +169,39 @@ private:
 
   int max_undistributed_patch;  // the patch with the most undistributed energy
   double total_undistributed;    // the total amount of undistributed light
+  IndexedMaxHeap undistributed_heap;  // keyed on undistributed energy * area
+  int num_iterations;            // since the last Reset
+  // the emission & diffuse color of each patch, initialized from the
+  // materials.  the colors are stored one array per channel (for the
+  // batched iteration)
+  std::vector<Vec3f> emitted;
+  std::vector<float> diffuse_r, diffuse_g, diffuse_b;
+  // for interpolation: the patches around each vertex (by vertex
+  // index), the patches of vertex v are vertex_faces[vertex_face_start[v]]
+  // up to vertex_faces[vertex_face_start[v+1]]
+  std::vector<int> vertex_face_start;
+  std::vector<int> vertex_faces;
+  std::vector<Vec3f> patch_normal;
+
+  // estimate of the light not yet accounted for, added to the display
+  // with -ambient_correction
+  Vec3f ambient;
   double total_area;             // the total area of the scene
 
+  // for -radiosity_indirect: the indirect irradiance interpolated at
+  // the 4 corners of every patch & the index used to find the patch
+  std::vector<Vec3f> indirect_corners;
+  PatchGrid patch_grid;
+
   // VBOs
   GLuint mesh_quad_verts_VBO;
+  GLuint mesh_quad_colors_VBO;
   GLuint mesh_quad_indices_VBO;
   GLuint mesh_textured_quad_indices_VBO;
   GLuint mesh_interior_edge_indices_VBO;
   GLuint mesh_border_edge_indices_VBO;
-  std::vector<VBOPosNormalColorTexture> mesh_quad_verts; 
+  std::vector<VBOPosNormalTexture> mesh_quad_verts; 
+  std::vector<VBOColor> mesh_quad_colors;
   std::vector<VBOIndexedQuad> mesh_quad_indices;
   std::vector<VBOIndexedQuad> mesh_textured_quad_indices;
   std::vector<VBOIndexedEdge> mesh_interior_edge_indices;
@@ -0,0 +1,76 @@
+#include <cmath>
+
+#include "ray_packet.h"
+#include "utils.h"
+
+// ====================================================================
+// ====================================================================
+
+bool RayPacket::ComputeFrustum() {
+  has_frustum = false;
+  if (size == 0) return false;
+  // the rays must share an origin (the primary rays of an orthographic
+  // camera don't)
+  for (int i = 1; i < size; i++) {
+    if (ox[i] != ox[0] || oy[i] != oy[0] || oz[i] != oz[0]) return false;
+  }
+  origin = Vec3f(ox[0],oy[0],oz[0]);
+
+  // a frame around the average direction
+  Vec3f w(0,0,0);
+  for (int i = 0; i < size; i++) {
+    Vec3f d(dx[i],dy[i],dz[i]);
+    d.Normalize();
+    w += d;
+  }
+  if (w.Length() < EPSILON) return false;
+  w.Normalize();
+  Vec3f axis = (fabs(w.x()) < 0.5) ? Vec3f(1,0,0) : Vec3f(0,1,0);
+  Vec3f u, v;
+  Vec3f::Cross3(u,w,axis);
+  u.Normalize();
+  Vec3f::Cross3(v,w,u);
+
+  // the range of the ray slopes in that frame
+  double u_min = 0, u_max = 0, v_min = 0, v_max = 0;
+  for (int i = 0; i < size; i++) {
+    Vec3f d(dx[i],dy[i],dz[i]);
+    double dw = d.Dot3(w);
+    if (dw < 0.1 * d.Length()) return false;
+    double su = d.Dot3(u) / dw;
+    double sv = d.Dot3(v) / dw;
+    if (i == 0 || su < u_min) u_min = su;
+    if (i == 0 || su > u_max) u_max = su;
+    if (i == 0 || sv < v_min) v_min = sv;
+    if (i == 0 || sv > v_max) v_max = sv;
+  }
+  // a little slack, so a single ray still has a (thin) frustum
+  double slack = 0.000001;
+  u_min -= slack; u_max += slack;
+  v_min -= slack; v_max += slack;
+
+  // su >= u_min  <=>  (u - u_min w).(p-origin) >= 0 in front of the
+  // origin, and together the 4 planes leave out everything behind it
+  planes[0] = u - u_min * w;
+  planes[1] = u_max * w - u;
+  planes[2] = v - v_min * w;
+  planes[3] = v_max * w - v;
+  has_frustum = true;
+  return true;
+}
+
+bool RayPacket::MayHit(const Vec3f &minimum, const Vec3f &maximum) const {
+  if (!has_frustum) return true;
+  for (int i = 0; i < 4; i++) {
+    // the corner of the box farthest inside of this plane
+    const Vec3f &n = planes[i];
+    Vec3f p((n.x() >= 0) ? maximum.x() : minimum.x(),
+            (n.y() >= 0) ? maximum.y() : minimum.y(),
+            (n.z() >= 0) ? maximum.z() : minimum.z());
+    if (n.Dot3(p - origin) < 0) return false;
+  }
+  return true;
+}
+
+// ====================================================================
+// ====================================================================
@@ -0,0 +1,81 @@
+#ifndef _RAY_PACKET_H_
+#define _RAY_PACKET_H_
+
+#include <cassert>
+#include "vectors.h"
+#include "ray.h"
+
+// 2x2 or 4x4 neighboring samples
+#define RAY_PACKET_SIZE 16
+
+// ====================================================================
+// ====================================================================
+// A bundle of coherent rays: the primary rays of a few neighboring
+// samples, or the shadow rays from a point to the corners of a light.
+// The rays are stored one array per component, so the intersection
+// loops run over the rays of the packet.
+//
+// If all the rays start at the same point, the packet also keeps a
+// frustum around them, and an object whose bounding box is outside of
+// the frustum can be skipped for the whole packet with one test.
+
+class RayPacket {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  RayPacket() { size = 0; has_frustum = false; }
+
+  // =========
+  // ACCESSORS
+  int numRays() const { return size; }
+  Ray getRay(int i) const {
+    assert (i >= 0 && i < size);
+    return Ray(Vec3f(ox[i],oy[i],oz[i]),Vec3f(dx[i],dy[i],dz[i])); }
+  bool hasFrustum() const { return has_frustum; }
+  // could any ray of the packet (or any ray inside of its frustum)
+  // hit this box?  always true if the packet has no frustum
+  bool MayHit(const Vec3f &minimum, const Vec3f &maximum) const;
+
+  // =========
+  // MODIFIERS
+  void Clear() { size = 0; has_frustum = false; }
+  void Add(const Ray &r) {
+    assert (size < RAY_PACKET_SIZE);
+    const Vec3f &o = r.getOrigin();
+    const Vec3f &d = r.getDirection();
+    ox[size] = o.x(); oy[size] = o.y(); oz[size] = o.z();
+    dx[size] = d.x(); dy[size] = d.y(); dz[size] = d.z();
+    size++;
+    has_frustum = false; }
+  // after filling the first n entries of the arrays directly (e.g. with
+  // Camera::generateRays)
+  void setNumRays(int n) {
+    assert (n >= 0 && n <= RAY_PACKET_SIZE);
+    size = n;
+    has_frustum = false; }
+  // call after the last Add.  returns false (and leaves the packet
+  // without a frustum) if the rays don't share an origin or spread over
+  // more than a hemisphere
+  bool ComputeFrustum();
+
+  // ==============
+  // REPRESENTATION
+  // (public, for the intersection loops)
+  double ox[RAY_PACKET_SIZE], oy[RAY_PACKET_SIZE], oz[RAY_PACKET_SIZE];
+  double dx[RAY_PACKET_SIZE], dy[RAY_PACKET_SIZE], dz[RAY_PACKET_SIZE];
+
+private:
+  int size;
+  // the 4 side planes of the frustum all pass through the common
+  // origin, the inside is where normal.(p-origin) >= 0
+  bool has_frustum;
+  Vec3f origin;
+  Vec3f planes[4];
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
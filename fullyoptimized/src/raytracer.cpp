@@ -8,8 +8,41 @@
 #include "face.h"
 #include "primitive.h"
 #include "photon_mapping.h"
+#include "radiosity.h"
+#include "sampler.h"
 
 
+// ===========================================================================
+// CONSTRUCTOR
+RayTracer::RayTracer(Mesh *m, ArgParser *a) {
+  mesh = m;
+  args = a;
+  radiosity = NULL;
+  photon_mapping = NULL;
+  // the lights don't move (subdivision leaves the original quads alone)
+  light_sampler.Build(mesh->getLights());
+  shadow_cache.Initialize(*mesh->getBoundingBox());
+  // boxes around the occluders, for culling ray packets
+  for (int i = 0; i < mesh->numOriginalQuads(); i++) {
+    Face *f = mesh->getOriginalQuad(i);
+    Vec3f minimum = (*f)[0]->get();
+    Vec3f maximum = minimum;
+    for (int k = 1; k < 4; k++) {
+      Vec3f p = (*f)[k]->get();
+      minimum = Vec3f(my_min(minimum.x(),p.x()),my_min(minimum.y(),p.y()),my_min(minimum.z(),p.z()));
+      maximum = Vec3f(my_max(maximum.x(),p.x()),my_max(maximum.y(),p.y()),my_max(maximum.z(),p.z()));
+    }
+    occluder_min.push_back(minimum - Vec3f(EPSILON,EPSILON,EPSILON));
+    occluder_max.push_back(maximum + Vec3f(EPSILON,EPSILON,EPSILON));
+  }
+  for (int i = 0; i < mesh->numPrimitives(); i++) {
+    Vec3f minimum, maximum;
+    mesh->getPrimitive(i)->getBounds(minimum,maximum);
+    occluder_min.push_back(minimum - Vec3f(EPSILON,EPSILON,EPSILON));
+    occluder_max.push_back(maximum + Vec3f(EPSILON,EPSILON,EPSILON));
+  }
+}
+
 // ===========================================================================
 // casts a single ray through the scene geometry and finds the closest hit
 bool RayTracer::CastRay(const Ray &ray, Hit &h, bool use_rasterized_patches) const {
@@ -36,20 +69,330 @@ bool RayTracer::CastRay(const Ray &ray, Hit &h, bool use_rasterized_patches) con
   return answer;
 }
 
+// ===========================================================================
+// the same for a packet of rays, with the objects culled against the
+// packet's frustum first (the packet is only as good as its rays are
+// coherent: after a bounce the rays go their own ways, so the reflected
+// rays are cast one at a time)
+void RayTracer::CastPacket(RayPacket &packet, Hit hits[]) const {
+  int n = packet.numRays();
+  for (int i = 0; i < n; i++) {
+    hits[i] = Hit();
+  }
+  if (!packet.hasFrustum()) packet.ComputeFrustum();
+  int num_quads = mesh->numOriginalQuads();
+  for (int i = 0; i < num_quads; i++) {
+    if (!packet.MayHit(occluder_min[i],occluder_max[i])) continue;
+    mesh->getOriginalQuad(i)->intersect(packet,hits,args->intersect_backfacing);
+  }
+  int num_primitives = mesh->numPrimitives();
+  for (int i = 0; i < num_primitives; i++) {
+    if (!packet.MayHit(occluder_min[num_quads+i],occluder_max[num_quads+i])) continue;
+    Primitive *p = mesh->getPrimitive(i);
+    for (int k = 0; k < n; k++) {
+      p->intersect(packet.getRay(k),hits[k]);
+    }
+  }
+}
+
+void RayTracer::TracePacket(RayPacket &packet, Hit hits[], Vec3f colors[], int bounce_count) const {
+  CastPacket(packet,hits);
+  for (int i = 0; i < packet.numRays(); i++) {
+    colors[i] = Shade(packet.getRay(i),hits[i],bounce_count,0,Vec3f(1,1,1));
+  }
+}
+
+// ===========================================================================
+// shadow rays only need to know if something is in the way, not what is
+// closest, so the search stops at the first blocker.  the occluders are
+// numbered the original quads first, then the primitives
+bool RayTracer::Blocks(int i, const Ray &ray, double dist) const {
+  Hit h;
+  int num_quads = mesh->numOriginalQuads();
+  bool answer = (i < num_quads) ?
+    mesh->getOriginalQuad(i)->intersect(ray,h,args->intersect_backfacing) :
+    mesh->getPrimitive(i-num_quads)->intersect(ray,h);
+  return answer && h.getT() <= dist - EPSILON;
+}
+
+int RayTracer::FindOccluder(const Ray &ray, double dist, int guess, const RayPacket *frustum) const {
+  int num_occluders = mesh->numOriginalQuads() + mesh->numPrimitives();
+  if (guess >= num_occluders) guess = -1;
+  if (guess >= 0 && Blocks(guess,ray,dist)) return guess;
+  for (int i = 0; i < num_occluders; i++) {
+    if (i == guess) continue;
+    if (frustum != NULL && !frustum->MayHit(occluder_min[i],occluder_max[i])) continue;
+    if (Blocks(i,ray,dist)) return i;
+  }
+  return -1;
+}
+
+// ===========================================================================
+// the direct light from one area light, with adaptive shadow rays
+Vec3f RayTracer::DirectLight(int i, const Ray &ray, const Hit &hit, const Vec3f &point) const {
+	Material *m = hit.getMaterial();
+	Vec3f normal = hit.getNormal();
+	const LightInfo &light = light_sampler.getLight(i);
+	Face *f = light.face;
+	Vec3f lightColor = light.color;
+	Vec3f myLightColor;
+	Vec3f lightCentroid = light.centroid;
+	Vec3f dirToLightCentroid = lightCentroid - point;
+	dirToLightCentroid.Normalize();
+
+	float distToLightCentroid = (lightCentroid - point).Length();
+	myLightColor = lightColor / float(M_PI*distToLightCentroid*distToLightCentroid);
+
+	//For each shadow sample, cast a light ray
+	if (args->num_shadow_samples <= 1)
+	{
+		args->num_shadow_samples = 1;
+	}
+	// the shadow photons can settle fully lit & fully shadowed points
+	// without any shadow rays
+	enum LIGHT_VISIBILITY visibility = LIGHT_PARTIAL;
+	if (args->shadow_photons && photon_mapping != NULL)
+		visibility = photon_mapping->LightVisibility(i, point, normal);
+	if (visibility == LIGHT_HIDDEN)
+		return Vec3f(0,0,0);
+	// the occluder & penumbra flag left here by the points shaded nearby
+	int slot = shadow_cache.Slot(i, point);
+	int occluder = shadow_cache.getOccluder(slot);
+	bool near_penumbra = shadow_cache.isPenumbra(slot);
+	// every shadow ray to this light stays inside of the frustum from
+	// the point through the corners of the light
+	RayPacket frustum;
+	const RayPacket *shadow_frustum = NULL;
+	if (visibility != LIGHT_VISIBLE)
+	{
+		for (int k = 0; k < 4; k++)
+			frustum.Add(Ray(point, light.corners[k] - point));
+		if (frustum.ComputeFrustum())
+			shadow_frustum = &frustum;
+	}
+	//Adaptive samples
+	Vec3f shadeanswer(0, 0, 0);
+	int shadecounter = 0;
+	for (int k = 0; k < 4; k++)
+	{
+		Vec3f lightCorner;
+		lightCorner = light.corners[k];
+		dirToLightCentroid = (lightCorner - point);
+		dirToLightCentroid.Normalize();
+
+		distToLightCentroid = (lightCorner - point).Length();
+		if (visibility == LIGHT_VISIBLE)
+		{
+			// known to be lit, no ray needed
+			Vec3f part = m->Shade(ray, hit, dirToLightCentroid, myLightColor, args);
+			shadeanswer += part;
+			shadecounter++;
+			continue;
+		}
+		//Cast a ray towards the light source, the light is visible if
+		//nothing is in the way before it
+		Ray r(point, dirToLightCentroid);
+		int blocker = FindOccluder(r, distToLightCentroid, occluder, shadow_frustum);
+		if (blocker < 0)
+		{
+			RayTree::AddShadowSegment(r, 0, distToLightCentroid);
+			Vec3f part = m->Shade(ray, hit, dirToLightCentroid, myLightColor, args);
+			shadeanswer += part;
+			shadecounter++;
+		}
+		else
+		{
+			occluder = blocker;
+		}
+	}
+	if (visibility == LIGHT_VISIBLE)
+	{
+		return shadeanswer * .25;
+	}
+
+	// the corners agree on fully lit or fully blocked.  if the points
+	// nearby were in the penumbra, a small occluder could be hiding
+	// between the corners, so check the middle of the light as well
+	bool penumbra = (shadecounter != 0 && shadecounter != 4);
+	if (!penumbra && near_penumbra)
+	{
+		dirToLightCentroid = light.centroid - point;
+		distToLightCentroid = dirToLightCentroid.Length();
+		dirToLightCentroid.Normalize();
+		Ray r(point, dirToLightCentroid);
+		int blocker = FindOccluder(r, distToLightCentroid, occluder, shadow_frustum);
+		if (blocker >= 0)
+			occluder = blocker;
+		penumbra = ((blocker < 0) != (shadecounter == 4));
+	}
+	if (!penumbra)
+	{
+		shadow_cache.Store(slot, occluder, false);
+		return shadeanswer * .25;
+	}
+
+	//Some obstructions: half of the shadow samples are always taken,
+	//the other half only as far as the rays so far disagree (a lit
+	//fraction p has variance p(1-p), the largest at p = 1/2).  the
+	//corners count towards p, but are left out of the estimate, which
+	//they would bias towards the light's edges
+	Vec3f sampleanswer(0, 0, 0);
+	Sampler sampler(args->sampler);
+	unsigned int seed = HashSeed(HashPoint(point), i);
+	int num_samples = args->num_shadow_samples;
+	int first_batch = (num_samples + 1) / 2;
+	int total = first_batch;
+	int num_traced = 4;
+	int num_lit = shadecounter;
+	int num_taken = 0;
+	for (int k = 0; k < total; k++)
+	{
+		double s, t;
+		sampler.Get2D(k, num_samples, SAMPLE_LIGHT, seed, s, t);
+		lightCentroid = f->PointAt(s, t);
+
+		dirToLightCentroid = (lightCentroid - point);
+		distToLightCentroid = dirToLightCentroid.Length();
+		dirToLightCentroid.Normalize();
+
+		//Cast a ray towards the light source
+		Ray r(point, dirToLightCentroid);
+		int blocker = FindOccluder(r, distToLightCentroid, occluder, shadow_frustum);
+		num_traced++;
+		num_taken++;
+		if (blocker < 0)
+		{
+			RayTree::AddShadowSegment(r, 0, distToLightCentroid);
+			Vec3f part = m->Shade(ray, hit, dirToLightCentroid, myLightColor, args);
+			sampleanswer += part;
+			num_lit++;
+		}
+		else
+		{
+			occluder = blocker;
+		}
+		if (k == first_batch - 1)
+		{
+			double p = num_lit / double(num_traced);
+			total += (int)ceil((num_samples - first_batch) * 4 * p * (1 - p));
+		}
+	}
+	shadow_cache.Store(slot, occluder, true);
+	return sampleanswer * (1.0 / num_taken);
+}
+
+// ===========================================================================
+Vec3f RayTracer::BackgroundColor() const {
+  return Vec3f(srgb_to_linear(mesh->background_color.r()),
+               srgb_to_linear(mesh->background_color.g()),
+               srgb_to_linear(mesh->background_color.b()));
+}
+
+Vec3f RayTracer::IndirectLight(const Ray &ray, const Hit &hit) const {
+  Material *m = hit.getMaterial();
+  Vec3f normal = hit.getNormal();
+  Vec3f point = ray.pointAtParameter(hit.getT());
+  Vec3f diffuse_color = m->getDiffuseColor(hit.get_s(),hit.get_t());
+  if (args->gather_indirect) {
+    // photon mapping for more accurate indirect light
+    return diffuse_color * (photon_mapping->GatherIndirect(point, normal, ray.getDirection()) + args->ambient_light);
+  } else if (args->radiosity_indirect && radiosity != NULL) {
+    // the radiosity solution, looked up at the hit, for diffuse interreflection
+    return diffuse_color * radiosity->IndirectIrradiance(point, normal);
+  } else {
+    // the usual ray tracing hack for indirect light
+    return diffuse_color * args->ambient_light;
+  }
+}
+
+void RayTracer::ChooseLights(const Vec3f &point, const Vec3f &normal,
+                             std::vector<int> &lights, std::vector<double> &weights) const {
+  int num_lights = light_sampler.numLights();
+  if (args->light_bvh && num_lights > 1) {
+    // walk the light BVH towards the lights that matter most here
+    int samples = my_max(1,args->sample_lights);
+    Sampler sampler(args->sampler);
+    unsigned int seed = HashSeed(HashPoint(point));
+    for (int k = 0; k < samples; k++) {
+      double u,v,probability;
+      sampler.Get2D(k, samples, SAMPLE_LIGHT_CHOICE, seed, u, v);
+      int i = light_sampler.SampleBVH(point, normal, u, probability);
+      // a walk that ends at two unimportant children contributes 0,
+      // the other samples keep their 1/samples weight
+      if (i < 0) continue;
+      lights.push_back(i);
+      weights.push_back(1.0 / (probability * samples));
+    }
+  } else if (args->sample_lights > 0 && args->sample_lights < num_lights) {
+    // visit a few lights picked by power instead of all of them, each
+    // weighted by 1/(probability * samples) so the sum stays unbiased
+    Sampler sampler(args->sampler);
+    unsigned int seed = HashSeed(HashPoint(point));
+    for (int k = 0; k < args->sample_lights; k++) {
+      double u,v;
+      sampler.Get2D(k, args->sample_lights, SAMPLE_LIGHT_CHOICE, seed, u, v);
+      int i = light_sampler.Sample(u,v);
+      lights.push_back(i);
+      weights.push_back(1.0 / (light_sampler.getProbability(i) * args->sample_lights));
+    }
+  } else {
+    for (int i = 0; i < num_lights; i++) {
+      lights.push_back(i);
+      weights.push_back(1.0);
+    }
+  }
+}
+
 // ===========================================================================
 // does the recursive (shadow rays & recursive rays) work
-Vec3f RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count,int count) const {
+Vec3f RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count,int count,
+                          const Vec3f &throughput) const {
 
   // First cast a ray and see if we hit anything.
   hit = Hit();
-  bool intersect = CastRay(ray,hit,false);
+  CastRay(ray,hit,false);
+  return Shade(ray,hit,bounce_count,count,throughput);
+}
+
+// below this roughness a material is a mirror
+#define MIRROR_ROUGHNESS 0.01
+// materials this rough get all of the -num_glossy_samples rays
+#define FULL_GLOSSY_ROUGHNESS 0.3
+
+int RayTracer::GlossySamples(const Material *m, int count) const {
+  double roughness = m->getRoughness();
+  if (roughness < MIRROR_ROUGHNESS) return 1;
+  // a quarter as many at each bounce, so the tree of rays stays small
+  int samples = (int)ceil(args->num_glossy_samples * my_min(1.0, roughness / FULL_GLOSSY_ROUGHNESS));
+  return my_max(1, samples >> my_min(30, 2*count));
+}
+
+bool RayTracer::ReflectionDirection(const Ray &ray, const Hit &hit, int k, int n, unsigned int seed,
+                                    Vec3f &direction) const {
+  const Vec3f &d = ray.getDirection();
+  Vec3f normal = hit.getNormal();
+  direction = d - 2*(d.Dot3(normal))*normal;
+  if (hit.getMaterial()->getRoughness() < MIRROR_ROUGHNESS) return true;
+  direction.Normalize();
+  double u, v;
+  Sampler(args->sampler).Get2D(k, n, SAMPLE_GLOSSY, seed, u, v);
+  direction = PhongLobeDirection(direction, hit.getMaterial()->getGlossyExponent(), u, v);
+  return direction.Dot3(normal) > 0;
+}
+
+double RayTracer::ContinueProbability(const Vec3f &throughput, int count) const {
+  if (count < args->russian_roulette_depth) return 1;
+  return my_min(1.0,my_max(throughput.r(),my_max(throughput.g(),throughput.b())));
+}
+
+// ===========================================================================
+// everything after the first hit (shared with the ray packets)
+Vec3f RayTracer::Shade(const Ray &ray, const Hit &hit, int bounce_count, int count,
+                       const Vec3f &throughput) const {
 
   // if there is no intersection, simply return the background color
-  if (intersect == false) {
-    return Vec3f(srgb_to_linear(mesh->background_color.r()),
-		 srgb_to_linear(mesh->background_color.g()),
-		 srgb_to_linear(mesh->background_color.b()));
-    
+  if (hit.getMaterial() == NULL) {
+    return BackgroundColor();
   }
   // otherwise decide what to do based on the material
   Material *m = hit.getMaterial();
@@ -63,112 +406,18 @@ Vec3f RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count,int count) const
   
   Vec3f normal = hit.getNormal();
   Vec3f point = ray.pointAtParameter(hit.getT());
-  Vec3f answer;
 
   // ----------------------------------------------
   //  start with the indirect light (ambient light)
-  Vec3f diffuse_color = m->getDiffuseColor(hit.get_s(),hit.get_t());
-  if (args->gather_indirect) {
-    // photon mapping for more accurate indirect light
-    answer = diffuse_color * (photon_mapping->GatherIndirect(point, normal, ray.getDirection()) + args->ambient_light);
-  } else {
-    // the usual ray tracing hack for indirect light
-    answer = diffuse_color * args->ambient_light;
-  }      
+  Vec3f answer = IndirectLight(ray, hit);
   // ----------------------------------------------
-  // add contributions from each light that is not in shadow
-	int num_lights = mesh->getLights().size();
-	for (int i = 0; i < num_lights; i++) {
-
-		Face *f = mesh->getLights()[i];
-		Vec3f lightColor = f->getMaterial()->getEmittedColor() * f->getArea();
-		Vec3f myLightColor;
-		Vec3f lightCentroid = f->computeCentroid();
-		Vec3f dirToLightCentroid = lightCentroid - point;
-		dirToLightCentroid.Normalize();
-
-		float distToLightCentroid = (lightCentroid - point).Length();
-		myLightColor = lightColor / float(M_PI*distToLightCentroid*distToLightCentroid);
-
-		//For each shadow sample, cast a light ray
-		if (args->num_shadow_samples <= 1)
-		{
-			args->num_shadow_samples = 1;
-		}
-		//Adaptive samples
-		//std::vector<glm::vec3> shading;
-		Vec3f shadeanswer(0, 0, 0);
-		std::vector<Vec3f> shading;
-		int shadecounter = 0;
-		for (int i = 0; i < 4; i++)
-		{
-			Vec3f lightCorner;
-			lightCorner = (*f)[i]->get();
-			dirToLightCentroid = (lightCorner - point);
-			dirToLightCentroid.Normalize();
-
-			//Cast a ray towards the light source
-			Ray r(point, dirToLightCentroid);
-			Hit Lhit = Hit();
-			bool Lintersect = CastRay(r, Lhit, false);
-			// If there is no intersection, cast a ray to the light source
-			// The ray will hit an object or the light source, if it is the light the distance of the ray Hit will be ~distToLightCentroid
-			distToLightCentroid = (lightCorner - point).Length();
-			if (Lhit.getT() > distToLightCentroid - (float)EPSILON)
-			{
-				RayTree::AddShadowSegment(r, 0, distToLightCentroid);
-				Vec3f part = m->Shade(ray, hit, dirToLightCentroid, myLightColor, args);
-				shading.push_back(part);
-				part *= .25;
-				shadeanswer += part;
-				shadecounter++;
-			}
-		}
-
-		bool withinBounds = true;
-		//No obstructions
-		if (shadecounter == 4)
-		{
-			//return shadeanswer;
-			answer += shadeanswer;
-		}
-		//All obstructions
-		else if (shadecounter==0)
-		{
-			answer += shadeanswer;
-		}
-		//Some obstructions
-		else
-		{
-			shadeanswer = Vec3f(0, 0, 0);
-			//return Vec3f(1,0,0);
-
-			for (int i = 0; i < args->num_shadow_samples; i++)
-			{
-				lightCentroid = f->RandomPoint();
-
-				dirToLightCentroid = (lightCentroid - point);
-				dirToLightCentroid.Normalize();
-
-				//Cast a ray towards the light source
-				Ray r(point, dirToLightCentroid);
-				Hit Lhit = Hit();
-				bool Lintersect = CastRay(r, Lhit, false);
-				// If there is no intersection, cast a ray to the light source
-				// The ray will hit an object or the light source, if it is the light the distance of the ray Hit will be ~distToLightCentroid
-				distToLightCentroid = (lightCentroid - point).Length();
-				if (Lhit.getT() > distToLightCentroid - (float)EPSILON)
-				{
-					RayTree::AddShadowSegment(r, 0, distToLightCentroid);
-					Vec3f part = m->Shade(ray, hit, dirToLightCentroid, myLightColor, args);
-
-					shadeanswer += part;
-				}
-			}
-			shadeanswer *= 1.0/args->num_shadow_samples;
-			answer += shadeanswer;
-		}
-	}
+  // add contributions from the lights that are not in shadow
+  std::vector<int> lights;
+  std::vector<double> weights;
+  ChooseLights(point, normal, lights, weights);
+  for (unsigned int k = 0; k < lights.size(); k++) {
+    answer += weights[k] * DirectLight(lights[k], ray, hit, point);
+  }
   // ----------------------------------------------
   // add contribution from reflection, if the surface is shiny
   Vec3f reflectiveColor = m->getReflectiveColor();
@@ -178,12 +427,35 @@ Vec3f RayTracer::TraceRay(Ray &ray, Hit &hit, int bounce_count,int count) const
   // =================================
   // ASSIGNMENT:  ADD REFLECTIVE LOGIC
   // =================================
-  if (count<bounce_count)
+  // (nothing to trace if the surface doesn't reflect)
+  if (count<bounce_count && reflectiveColor.Length() > 0)
   {
-	  Ray r2( point,ray.getDirection()-2*(ray.getDirection().Dot3(normal))*normal);
-	  Hit h2;
-	  answer+=reflectiveColor*TraceRay(r2,h2,bounce_count,count+1);
-	  RayTree::AddReflectedSegment(r2,0,h2.getT());
+	  // past a few bounces, the dim paths are stopped at random & the
+	  // survivors scaled up by 1/probability, so the average is unchanged
+	  Vec3f path = throughput * reflectiveColor;
+	  double probability = ContinueProbability(path, count);
+	  double u = 0, v = 0;
+	  if (probability < 1)
+		  Sampler(args->sampler).Get2D(0, 1, SAMPLE_ROULETTE, HashSeed(HashPoint(point), count), u, v);
+	  if (u < probability)
+	  {
+		  // a rough surface spreads the reflection over a lobe around the
+		  // mirror direction, estimated with a few rays sampled from it
+		  int n = GlossySamples(m, count);
+		  unsigned int seed = HashSeed(HashPoint(point), count);
+		  Vec3f reflected(0,0,0);
+		  for (int k = 0; k < n; k++)
+		  {
+			  // (the part of the lobe below the surface is lost)
+			  Vec3f direction;
+			  if (!ReflectionDirection(ray, hit, k, n, seed, direction)) continue;
+			  Ray r2( point,direction);
+			  Hit h2;
+			  reflected+=TraceRay(r2,h2,bounce_count,count+1,path*(1/probability));
+			  RayTree::AddReflectedSegment(r2,0,h2.getT());
+		  }
+		  answer+=(reflectiveColor*(1/(probability*n)))*reflected;
+	  }
   }
 
 
@@ -4,11 +4,15 @@
 #include <vector>
 #include "ray.h"
 #include "hit.h"
+#include "light_sampler.h"
+#include "shadow_cache.h"
+#include "ray_packet.h"
 
 class Mesh;
 class ArgParser;
 class Radiosity;
 class PhotonMapping;
+class Material;
 
 // ====================================================================
 // ====================================================================
@@ -19,10 +23,7 @@ class RayTracer {
 public:
 
   // CONSTRUCTOR & DESTRUCTOR
-  RayTracer(Mesh *m, ArgParser *a) {
-    mesh = m;
-    args = a;
-  }  
+  RayTracer(Mesh *m, ArgParser *a);
   // set access to the other modules for hybrid rendering options
   void setRadiosity(Radiosity *r) { radiosity = r; }
   void setPhotonMapping(PhotonMapping *pm) { photon_mapping = pm; }
@@ -30,16 +31,68 @@ public:
   // casts a single ray through the scene geometry and finds the closest hit
   bool CastRay(const Ray &ray, Hit &h, bool use_sphere_patches) const;
 
-  // does the recursive work
-  Vec3f TraceRay(Ray &ray, Hit &hit, int bounce_count = 0, int count = 0) const;
+  // does the recursive work.  the throughput is how much of the ray's
+  // color reaches the pixel (the product of the reflective colors so far)
+  Vec3f TraceRay(Ray &ray, Hit &hit, int bounce_count = 0, int count = 0,
+                 const Vec3f &throughput = Vec3f(1,1,1)) const;
+
+  // casts all the rays of a packet (hits[i] goes with ray i), skipping
+  // the objects outside of the packet's frustum for all of them at once
+  void CastPacket(RayPacket &packet, Hit hits[]) const;
+  // traces a packet of primary rays.  the packet is only used for the
+  // first hit, the reflected rays are traced one at a time
+  void TracePacket(RayPacket &packet, Hit hits[], Vec3f colors[], int bounce_count = 0) const;
+
+  // the pieces of the shading, for renderers that schedule the rays
+  // themselves (see WavefrontRenderer)
+  const LightSampler& getLightSampler() const { return light_sampler; }
+  Vec3f BackgroundColor() const;
+  // the indirect (ambient, photon map or radiosity) light at a hit
+  Vec3f IndirectLight(const Ray &ray, const Hit &hit) const;
+  // the lights to sample at a point & the weight of each (all of them,
+  // or a few picked by power or through the light BVH)
+  void ChooseLights(const Vec3f &point, const Vec3f &normal,
+                    std::vector<int> &lights, std::vector<double> &weights) const;
+  // the probability of tracing the reflected ray from a hit with this
+  // throughput after count bounces: 1 up to -russian_roulette_depth,
+  // then the largest channel of the throughput (at most 1)
+  double ContinueProbability(const Vec3f &throughput, int count) const;
+  // how many rays to reflect from a hit on this material after count
+  // bounces: 1 for a mirror, up to -num_glossy_samples for the roughest
+  // materials at the first hit, fewer deeper in the path
+  int GlossySamples(const Material *m, int count) const;
+  // the direction of reflected ray k of n: the mirror direction, or a
+  // sample of the material's glossy lobe around it.  false if the
+  // sample points into the surface (that ray carries no light)
+  bool ReflectionDirection(const Ray &ray, const Hit &hit, int k, int n, unsigned int seed,
+                           Vec3f &direction) const;
+  // the primitive blocking the ray before distance dist (-1 = none).
+  // the guess is tested first, then the first blocker found is returned.
+  // only the occluders inside of the frustum (if any) are tested
+  int FindOccluder(const Ray &ray, double dist, int guess, const RayPacket *frustum = NULL) const;
 
 private:
 
+  // HELPER FUNCTIONS
+  // the color of a ray that has been cast (the background if it missed)
+  Vec3f Shade(const Ray &ray, const Hit &hit, int bounce_count, int count,
+              const Vec3f &throughput) const;
+  Vec3f DirectLight(int light, const Ray &ray, const Hit &hit, const Vec3f &point) const;
+  bool Blocks(int occluder, const Ray &ray, double dist) const;
+
   // REPRESENTATION
   Mesh *mesh;
   ArgParser *args;
   Radiosity *radiosity;
   PhotonMapping *photon_mapping;
+  // the area lights, cached when the ray tracer is created
+  LightSampler light_sampler;
+  // the last occluder & penumbra flag near each shading point, per light
+  // (updated by all the render threads)
+  mutable ShadowCache shadow_cache;
+  // a box around each occluder (the original quads, then the primitives)
+  std::vector<Vec3f> occluder_min;
+  std::vector<Vec3f> occluder_max;
 };
 
 // ====================================================================
@@ -0,0 +1,161 @@
+#include <cmath>
+#include <cstring>
+
+#include "sampler.h"
+#include "utils.h"
+
+// ====================================================================
+// HELPER FUNCTIONS
+// ====================================================================
+
+// an integer hash with good avalanche (every input bit flips about
+// half of the output bits)
+static unsigned int Mix(unsigned int x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// a 32 bit integer to a double in [0,1)
+static double ToUnit(unsigned int x) {
+  return x * (1.0 / 4294967296.0);
+}
+
+static unsigned int ReverseBits(unsigned int x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+  return x;
+}
+
+// an Owen scramble of the bits of x (Laine & Karras 2011, with the
+// constants from Burley 2020): each bit is flipped depending on the
+// seed and on all of the more significant bits
+static unsigned int OwenScramble(unsigned int x, unsigned int seed) {
+  x = ReverseBits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return ReverseBits(x);
+}
+
+// the first two dimensions of the Sobol sequence (together they are a
+// (0,2)-sequence: every power of 2 block of samples is stratified)
+static unsigned int Sobol0(unsigned int i) {
+  return ReverseBits(i);
+}
+
+static unsigned int Sobol1(unsigned int i) {
+  unsigned int answer = 0;
+  for (unsigned int v = 1u << 31; i != 0; i >>= 1, v ^= v >> 1) {
+    if (i & 1) answer ^= v;
+  }
+  return answer;
+}
+
+static double RadicalInverse(unsigned int i, unsigned int base) {
+  double inv_base = 1.0 / base;
+  double f = inv_base;
+  double answer = 0;
+  while (i > 0) {
+    answer += f * (i % base);
+    i /= base;
+    f *= inv_base;
+  }
+  return answer;
+}
+
+// a pair of bases for each Halton dimension pair
+#define NUM_HALTON_PRIMES 32
+static const unsigned int halton_primes[NUM_HALTON_PRIMES] = {
+  2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+  59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131 };
+
+// ====================================================================
+// ====================================================================
+
+unsigned int HashSeed(unsigned int a, unsigned int b, unsigned int c) {
+  return Mix(a ^ Mix(b ^ Mix(c + 0x9e3779b9u)));
+}
+
+unsigned int HashPoint(const Vec3f &p) {
+  unsigned int bits[3];
+  for (int i = 0; i < 3; i++) {
+    float f = (float)p[i];
+    memcpy(&bits[i],&f,sizeof(float));
+  }
+  return HashSeed(bits[0],bits[1],bits[2]);
+}
+
+Vec3f CosineDirection(const Vec3f &normal, double u, double v) {
+  // an orthonormal basis around the normal
+  Vec3f axis = (fabs(normal.x()) < 0.5) ? Vec3f(1,0,0) : Vec3f(0,1,0);
+  Vec3f tangent, bitangent;
+  Vec3f::Cross3(tangent,normal,axis);
+  tangent.Normalize();
+  Vec3f::Cross3(bitangent,normal,tangent);
+  // uniform on the disk, projected up onto the hemisphere (Malley)
+  double r = sqrt(u);
+  double phi = 2 * M_PI * v;
+  Vec3f answer = r*cos(phi)*tangent + r*sin(phi)*bitangent + sqrt(my_max(0.0,1-u))*normal;
+  answer.Normalize();
+  return answer;
+}
+
+Vec3f PhongLobeDirection(const Vec3f &axis, double exponent, double u, double v) {
+  Vec3f helper = (fabs(axis.x()) < 0.5) ? Vec3f(1,0,0) : Vec3f(0,1,0);
+  Vec3f tangent, bitangent;
+  Vec3f::Cross3(tangent,axis,helper);
+  tangent.Normalize();
+  Vec3f::Cross3(bitangent,axis,tangent);
+  // invert the cdf of cos^exponent over the solid angle
+  double cos_theta = pow(1-u, 1/(exponent+1));
+  double sin_theta = sqrt(my_max(0.0,1-cos_theta*cos_theta));
+  double phi = 2 * M_PI * v;
+  Vec3f answer = sin_theta*cos(phi)*tangent + sin_theta*sin(phi)*bitangent + cos_theta*axis;
+  answer.Normalize();
+  return answer;
+}
+
+// ====================================================================
+
+void Sampler::Get2D(unsigned int index, unsigned int count, unsigned int dimension,
+                    unsigned int seed, double &u, double &v) const {
+  unsigned int s = HashSeed(seed,dimension);
+  if (type == SAMPLER_STRATIFIED) {
+    // jittered m x m grid, big enough for count samples.  the cells
+    // are rotated differently for each dimension pair
+    unsigned int m = (unsigned int)ceil(sqrt((double)my_max(1u,count)));
+    unsigned int cell = (index + s) % (m*m);
+    u = ((cell % m) + ToUnit(HashSeed(s,index,1))) / m;
+    v = ((cell / m) + ToUnit(HashSeed(s,index,2))) / m;
+  } else if (type == SAMPLER_HALTON) {
+    // a different pair of bases for each dimension pair, scrambled by
+    // a random toroidal shift (Cranley-Patterson rotation)
+    unsigned int d = (2*dimension) % NUM_HALTON_PRIMES;
+    u = RadicalInverse(index,halton_primes[d]) + ToUnit(HashSeed(s,1));
+    v = RadicalInverse(index,halton_primes[d+1]) + ToUnit(HashSeed(s,2));
+    if (u >= 1) u -= 1;
+    if (v >= 1) v -= 1;
+  } else if (type == SAMPLER_SOBOL) {
+    // Owen scrambled Sobol, with the sample order shuffled for each
+    // dimension pair (Burley 2020)
+    unsigned int i = OwenScramble(index,s);
+    u = ToUnit(OwenScramble(Sobol0(i),HashSeed(s,1)));
+    v = ToUnit(OwenScramble(Sobol1(i),HashSeed(s,2)));
+  } else {
+    assert (type == SAMPLER_RANDOM);
+    u = ToUnit(HashSeed(s,index,1));
+    v = ToUnit(HashSeed(s,index,2));
+  }
+}
+
+// ====================================================================
+// ====================================================================
@@ -0,0 +1,64 @@
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include "vectors.h"
+#include "argparser.h"
+
+// the dimension pairs used by the renderer (the photon bounces use
+// SAMPLE_PHOTON_BOUNCE + bounce number)
+enum SAMPLE_DIMENSION { SAMPLE_PIXEL, SAMPLE_LIGHT, SAMPLE_ROULETTE, SAMPLE_GLOSSY,
+                        SAMPLE_LIGHT_CHOICE, SAMPLE_PHOTON_POSITION, SAMPLE_PHOTON_DIRECTION, SAMPLE_PHOTON_BOUNCE };
+
+// ====================================================================
+// ====================================================================
+// Sample points in [0,1)^2 from a stratified, Halton or Sobol sequence
+// (or plain pseudo-random numbers).  A sample is addressed by its index
+// in the sequence, the dimension pair it is used for (pixel position,
+// point on a light, bounce direction, ...) and a seed that scrambles
+// the sequence, usually one per pixel or per shading point.  Nothing is
+// stored, so a single Sampler can be shared by all the render threads.
+//
+// Every dimension pair is scrambled differently, so the points used
+// for different decisions along one path are not correlated.
+
+class Sampler {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  Sampler(enum SAMPLER_TYPE t) : type(t) {}
+
+  // =========
+  // ACCESSORS
+  enum SAMPLER_TYPE getType() const { return type; }
+
+  // sample `index` of `count` (the stratified sampler needs to know
+  // how many samples there will be, the sequences don't)
+  void Get2D(unsigned int index, unsigned int count, unsigned int dimension,
+             unsigned int seed, double &u, double &v) const;
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  enum SAMPLER_TYPE type;
+};
+
+// ====================================================================
+// seeds for the scrambling
+
+unsigned int HashSeed(unsigned int a, unsigned int b = 0, unsigned int c = 0);
+unsigned int HashPoint(const Vec3f &p);
+
+// map a sample to a cosine weighted direction about the normal (the
+// same distribution as RandomDiffuseDirection)
+Vec3f CosineDirection(const Vec3f &normal, double u, double v);
+// map a sample to a direction about the axis with density proportional
+// to cos^exponent of the angle to the axis (a Phong lobe)
+Vec3f PhongLobeDirection(const Vec3f &axis, double exponent, double u, double v);
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -0,0 +1,36 @@
+#include <cmath>
+
+#include "shadow_cache.h"
+#include "boundingbox.h"
+#include "sampler.h"
+
+// about this many cells along the longest side of the scene
+#define SHADOW_CACHE_RESOLUTION 128
+
+// ====================================================================
+// ====================================================================
+
+void ShadowCache::Initialize(const BoundingBox &bbox) {
+  minimum = bbox.getMin();
+  Vec3f diagonal = bbox.getMax() - bbox.getMin();
+  double longest = my_max(diagonal.x(),my_max(diagonal.y(),diagonal.z()));
+  cell_size = my_max(longest,EPSILON) / SHADOW_CACHE_RESOLUTION;
+  Clear();
+}
+
+void ShadowCache::Clear() {
+  for (int i = 0; i < SHADOW_CACHE_SIZE; i++) {
+    entries[i] = 0;
+  }
+}
+
+int ShadowCache::Slot(int light, const Vec3f &p) const {
+  Vec3f offset = p - minimum;
+  unsigned int x = (unsigned int)(int)floor(offset.x() / cell_size);
+  unsigned int y = (unsigned int)(int)floor(offset.y() / cell_size);
+  unsigned int z = (unsigned int)(int)floor(offset.z() / cell_size);
+  return HashSeed(HashSeed(x,y,z),light) & (SHADOW_CACHE_SIZE-1);
+}
+
+// ====================================================================
+// ====================================================================
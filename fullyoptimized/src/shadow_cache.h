@@ -0,0 +1,54 @@
+#ifndef _SHADOW_CACHE_H_
+#define _SHADOW_CACHE_H_
+
+#include <windows.h>
+#include "vectors.h"
+
+class BoundingBox;
+
+#define SHADOW_CACHE_SIZE (1<<16)
+
+// ====================================================================
+// ====================================================================
+// Shadow coherence: for each light & small cell of the scene, the
+// primitive that last blocked a shadow ray and whether the last point
+// shaded there was in the penumbra.  Neighboring shading points
+// usually have the same occluder, so testing it first ends most
+// blocked shadow rays after one intersection.
+//
+// The cells are hashed into a fixed table.  A collision or a stale
+// entry only costs one wasted intersection (the occluder is always
+// verified), so the entries are updated without locks.
+
+class ShadowCache {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & INITIALIZE
+  ShadowCache() { cell_size = 1; Clear(); }
+  // the cells are a fraction of the scene size
+  void Initialize(const BoundingBox &bbox);
+  void Clear();
+
+  // the entry for light i at point p
+  int Slot(int light, const Vec3f &p) const;
+  // the cached occluder (-1 = none)
+  int getOccluder(int slot) const { return (entries[slot] >> 1) - 1; }
+  bool isPenumbra(int slot) const { return (entries[slot] & 1) != 0; }
+  void Store(int slot, int occluder, bool penumbra) {
+    InterlockedExchange(&entries[slot],((occluder+1) << 1) | (penumbra ? 1 : 0)); }
+
+private:
+
+  // ==============
+  // REPRESENTATION
+  Vec3f minimum;
+  double cell_size;
+  volatile LONG entries[SHADOW_CACHE_SIZE];
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
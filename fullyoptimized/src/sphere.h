@@ -19,6 +19,9 @@ public:
 
   // for ray tracing
   virtual bool intersect(const Ray &r, Hit &h) const;
+  virtual void getBounds(Vec3f &minimum, Vec3f &maximum) const {
+    minimum = center - Vec3f(radius,radius,radius);
+    maximum = center + Vec3f(radius,radius,radius); }
 
   // for OpenGL rendering & radiosity
   void addRasterizedFaces(Mesh *m, ArgParser *args);
@@ -73,6 +73,29 @@ struct VBOPosNormalColorTexture {
   float s,t;
 };
 
+struct VBOPosNormalTexture {
+  VBOPosNormalTexture() {}
+  VBOPosNormalTexture(const Vec3f &p, const Vec3f &n, float s_, float t_) {
+    x = p.x(); y = p.y(); z = p.z();
+    nx = n.x(); ny = n.y(); nz = n.z();
+    s = s_;
+    t = t_;
+  }
+  float x, y, z;    // position
+  float nx, ny, nz; // normal
+  float s,t;
+};
+
+// for colors that change more often than the geometry, kept in their
+// own buffer
+struct VBOColor {
+  VBOColor() {}
+  VBOColor(const Vec3f &c) {
+    r = c.r(); g = c.g(); b = c.b();
+  }
+  float r, g, b;    // color
+};
+
 // ======================================================================
 
 struct VBOIndexedEdge {
@@ -0,0 +1,333 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <windows.h>
+
+#include "wavefront.h"
+#include "argparser.h"
+#include "mesh.h"
+#include "face.h"
+#include "camera.h"
+#include "material.h"
+#include "boundingbox.h"
+#include "raytracer.h"
+#include "sampler.h"
+#include "utils.h"
+
+// the primary rays are traced in batches, so the shadow queue of a
+// batch stays around this many rays
+#define MAX_SHADOW_QUEUE (1<<20)
+
+enum WAVEFRONT_STAGE { WAVEFRONT_INTERSECT, WAVEFRONT_SHADE, WAVEFRONT_OCCLUDE };
+
+// ====================================================================
+// SORT KEYS
+// ====================================================================
+
+// spread the low 10 bits of x out to every third bit
+static unsigned long long SpreadBits(unsigned int x) {
+  unsigned long long v = x & 0x3ff;
+  v = (v | (v << 16)) & 0x030000ffULL;
+  v = (v | (v << 8)) & 0x0300f00fULL;
+  v = (v | (v << 4)) & 0x030c30c3ULL;
+  v = (v | (v << 2)) & 0x09249249ULL;
+  return v;
+}
+
+static unsigned int Quantize(double v, int bits) {
+  int max = (1 << bits) - 1;
+  return (unsigned int)my_max(0,my_min(max,(int)(v * (max+1))));
+}
+
+// from the most significant bits: the octant of the direction, the
+// Morton code of the origin (10 bits per axis) & a coarse direction
+// (5 bits per axis).  nearby rays going the same way sort together
+unsigned long long WavefrontRenderer::SortKey(const Vec3f &origin, const Vec3f &direction) const {
+  unsigned long long octant =
+    (direction.x() < 0 ? 4 : 0) | (direction.y() < 0 ? 2 : 0) | (direction.z() < 0 ? 1 : 0);
+  Vec3f o = origin - scene_min;
+  unsigned long long morton =
+    (SpreadBits(Quantize(o.x() / scene_size.x(),10)) << 2) |
+    (SpreadBits(Quantize(o.y() / scene_size.y(),10)) << 1) |
+    SpreadBits(Quantize(o.z() / scene_size.z(),10));
+  Vec3f d = direction;
+  d.Normalize();
+  unsigned long long coarse =
+    (Quantize(0.5*(d.x()+1),5) << 10) | (Quantize(0.5*(d.y()+1),5) << 5) | Quantize(0.5*(d.z()+1),5);
+  return (octant << 45) | (morton << 15) | coarse;
+}
+
+template <class T> struct KeyLess {
+  bool operator()(const T &a, const T &b) const { return a.key < b.key; }
+};
+
+// ====================================================================
+// THREADS
+// ====================================================================
+
+struct WavefrontVars {
+  WavefrontRenderer *renderer;
+  int stage;
+  int thread;
+  int first, last;
+};
+
+DWORD WINAPI WavefrontWorker(void *arg) {
+  WavefrontVars *vars = (WavefrontVars*)arg;
+  if (vars->stage == WAVEFRONT_INTERSECT) {
+    vars->renderer->Intersect(vars->first,vars->last);
+  } else if (vars->stage == WAVEFRONT_SHADE) {
+    vars->renderer->Shade(vars->first,vars->last,vars->thread);
+  } else {
+    assert (vars->stage == WAVEFRONT_OCCLUDE);
+    vars->renderer->Occlude(vars->first,vars->last);
+  }
+  return 0;
+}
+
+// split the n entries of the queue into one contiguous (so still
+// sorted) run per thread
+void WavefrontRenderer::RunStage(int stage, int n) {
+  if (n == 0) return;
+  int num_threads = my_max(1,my_min(args->num_threads,n));
+  std::vector<WavefrontVars> vars(num_threads);
+  std::vector<HANDLE> threads(num_threads);
+  for (int t = 0; t < num_threads; t++) {
+    vars[t].renderer = this;
+    vars[t].stage = stage;
+    vars[t].thread = t;
+    vars[t].first = (int)((long long)n * t / num_threads);
+    vars[t].last = (int)((long long)n * (t+1) / num_threads);
+    threads[t] = CreateThread(NULL, 0, WavefrontWorker, &vars[t], 0, NULL);
+  }
+  WaitForMultipleObjects(num_threads, &threads[0], TRUE, INFINITE);
+  for (int t = 0; t < num_threads; t++) {
+    CloseHandle(threads[t]);
+  }
+}
+
+// ====================================================================
+// STAGES
+// ====================================================================
+
+void WavefrontRenderer::Intersect(int first, int last) {
+  // neighbors in the sorted queue make decent packets
+  RayPacket packet;
+  for (int i = first; i < last; i += RAY_PACKET_SIZE) {
+    int n = my_min(RAY_PACKET_SIZE,last-i);
+    packet.Clear();
+    for (int k = 0; k < n; k++) {
+      packet.Add(Ray(rays[i+k].origin,rays[i+k].direction));
+    }
+    raytracer->CastPacket(packet,&hits[i]);
+  }
+}
+
+void WavefrontRenderer::Shade(int first, int last, int thread) {
+  std::vector<ShadowQuery> &shadow_queue = thread_shadows[thread];
+  std::vector<WavefrontRay> &ray_queue = thread_rays[thread];
+  const LightSampler &light_sampler = raytracer->getLightSampler();
+  Sampler sampler(args->sampler);
+  int num_samples = my_max(1,args->num_shadow_samples);
+  int antialias_samples = my_max(1,args->num_antialias_samples);
+  std::vector<int> lights;
+  std::vector<double> weights;
+  for (int i = first; i < last; i++) {
+    const WavefrontRay &wr = rays[i];
+    const Hit &hit = hits[i];
+    Ray ray(wr.origin,wr.direction);
+    Material *m = hit.getMaterial();
+    if (m == NULL) {
+      ray_colors[i] = wr.weight * raytracer->BackgroundColor();
+      continue;
+    }
+    if (m->getEmittedColor().Length() > 0.001) {
+      ray_colors[i] = wr.weight * m->getEmittedColor();
+      continue;
+    }
+    Vec3f normal = hit.getNormal();
+    Vec3f point = ray.pointAtParameter(hit.getT());
+    ray_colors[i] = wr.weight * raytracer->IndirectLight(ray,hit);
+
+    // queue the shadow rays, each carrying the light it brings if it
+    // gets through (the same estimate as the penumbra case of
+    // RayTracer::DirectLight)
+    lights.clear();
+    weights.clear();
+    raytracer->ChooseLights(point,normal,lights,weights);
+    unsigned int seed = HashPoint(point);
+    for (unsigned int k = 0; k < lights.size(); k++) {
+      const LightInfo &light = light_sampler.getLight(lights[k]);
+      double distance = (light.centroid - point).Length();
+      Vec3f light_color = light.color * (1.0 / (M_PI*distance*distance));
+      for (int s = 0; s < num_samples; s++) {
+        double u, v;
+        sampler.Get2D(s,num_samples,SAMPLE_LIGHT,HashSeed(seed,lights[k]),u,v);
+        ShadowQuery q;
+        q.origin = point;
+        q.target = light.face->PointAt(u,v);
+        Vec3f direction = q.target - point;
+        direction.Normalize();
+        q.color = wr.weight * (weights[k] / num_samples) *
+          m->Shade(ray,hit,direction,light_color,args);
+        // no need for a ray if the light doesn't reach this side
+        if (q.color.Length() == 0) continue;
+        q.pixel = wr.pixel;
+        q.key = SortKey(point,direction);
+        shadow_queue.push_back(q);
+      }
+    }
+
+    // queue the reflected ray (past a few bounces, only if it survives
+    // the russian roulette, as in RayTracer::Shade)
+    Vec3f reflective = m->getReflectiveColor();
+    if (wr.depth < args->num_bounces && reflective.Length() > 0) {
+      // the weight is the throughput over the samples per pixel
+      Vec3f path = wr.weight * reflective;
+      double probability = raytracer->ContinueProbability(path * antialias_samples, wr.depth);
+      double u = 0, v = 0;
+      if (probability < 1)
+        sampler.Get2D(0,1,SAMPLE_ROULETTE,HashSeed(HashPoint(point),wr.depth),u,v);
+      if (u >= probability) continue;
+      // one ray from the glossy lobe (the antialiasing samples already
+      // spread the rays of a pixel over it)
+      WavefrontRay r;
+      r.origin = point;
+      if (!raytracer->ReflectionDirection(ray,hit,0,1,HashSeed(HashPoint(point),wr.depth),r.direction))
+        continue;
+      r.weight = path * (1 / probability);
+      r.pixel = wr.pixel;
+      r.depth = wr.depth + 1;
+      r.key = SortKey(r.origin,r.direction);
+      ray_queue.push_back(r);
+    }
+  }
+}
+
+void WavefrontRenderer::Occlude(int first, int last) {
+  // sorted neighbors usually share their occluder, so it is the guess
+  // for the next ray
+  int guess = -1;
+  for (int i = first; i < last; i++) {
+    const ShadowQuery &q = shadows[i];
+    Vec3f direction = q.target - q.origin;
+    double distance = direction.Length();
+    direction.Normalize();
+    int blocker = raytracer->FindOccluder(Ray(q.origin,direction),distance,guess);
+    unblocked[i] = (blocker < 0);
+    if (blocker >= 0) guess = blocker;
+  }
+}
+
+// ====================================================================
+// ====================================================================
+
+void WavefrontRenderer::GeneratePrimaryRays() {
+  int max_d = my_max(width,height);
+  double pixel_size = 1.0 / max_d;
+  double offset_x = 0.5 - (width / 2.0) * pixel_size;
+  double offset_y = 0.5 - (height / 2.0) * pixel_size;
+  int num_samples = my_max(1,args->num_antialias_samples);
+  Sampler sampler(args->sampler);
+  rays.clear();
+  rays.reserve((size_t)width*height*num_samples);
+  // the camera makes the rays a scanline at a time
+  int n = width*num_samples;
+  std::vector<double> sx(n), sy(n), ox(n), oy(n), oz(n), dx(n), dy(n), dz(n);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      for (int k = 0; k < num_samples; k++) {
+        // the pixel center, or jittered samples for antialiasing
+        double u = 0.5, v = 0.5;
+        if (num_samples > 1) sampler.Get2D(k,num_samples,SAMPLE_PIXEL,HashSeed(y*width+x),u,v);
+        sx[x*num_samples+k] = (x - 0.5 + u) * pixel_size + offset_x;
+        sy[x*num_samples+k] = (y - 0.5 + v) * pixel_size + offset_y;
+      }
+    }
+    mesh->camera->generateRays(&sx[0],&sy[0],n,&ox[0],&oy[0],&oz[0],&dx[0],&dy[0],&dz[0]);
+    for (int i = 0; i < n; i++) {
+      WavefrontRay wr;
+      wr.origin = Vec3f(ox[i],oy[i],oz[i]);
+      wr.direction = Vec3f(dx[i],dy[i],dz[i]);
+      wr.weight = Vec3f(1,1,1) * (1.0 / num_samples);
+      wr.pixel = y*width + i/num_samples;
+      wr.depth = 0;
+      // the samples of a pixel, scanline by scanline, are already
+      // coherent, so the sort keeps that order
+      wr.key = rays.size();
+      rays.push_back(wr);
+    }
+  }
+}
+
+void WavefrontRenderer::Render() {
+  width = args->width;
+  height = args->height;
+  image.assign(width*height,Vec3f(0,0,0));
+  rays_traced = 0;
+  shadow_rays_traced = 0;
+  BoundingBox *bbox = mesh->getBoundingBox();
+  scene_min = bbox->getMin();
+  scene_size = bbox->getMax() - bbox->getMin();
+  scene_size = Vec3f(my_max(scene_size.x(),EPSILON),my_max(scene_size.y(),EPSILON),
+                     my_max(scene_size.z(),EPSILON));
+
+  // size the batches of primary rays by how many shadow rays each hit
+  // may queue
+  int num_lights = raytracer->getLightSampler().numLights();
+  int lights_per_hit = num_lights;
+  if (args->light_bvh || (args->sample_lights > 0 && args->sample_lights < num_lights))
+    lights_per_hit = my_max(1,args->sample_lights);
+  int shadows_per_hit = my_max(1,lights_per_hit * my_max(1,args->num_shadow_samples));
+  int batch = my_max(RAY_PACKET_SIZE,MAX_SHADOW_QUEUE / shadows_per_hit);
+
+  GeneratePrimaryRays();
+  std::vector<WavefrontRay> primary;
+  primary.swap(rays);
+  thread_shadows.resize(args->num_threads);
+  thread_rays.resize(args->num_threads);
+
+  for (unsigned int start = 0; start < primary.size(); start += batch) {
+    unsigned int end = my_min((unsigned int)primary.size(),start + batch);
+    rays.assign(primary.begin()+start,primary.begin()+end);
+    // one wave per bounce
+    while (!rays.empty()) {
+      int n = rays.size();
+      std::sort(rays.begin(),rays.end(),KeyLess<WavefrontRay>());
+      hits.assign(n,Hit());
+      ray_colors.assign(n,Vec3f(0,0,0));
+      RunStage(WAVEFRONT_INTERSECT,n);
+      for (int t = 0; t < args->num_threads; t++) {
+        thread_shadows[t].clear();
+        thread_rays[t].clear();
+      }
+      RunStage(WAVEFRONT_SHADE,n);
+      for (int i = 0; i < n; i++) {
+        image[rays[i].pixel] += ray_colors[i];
+      }
+      rays_traced += n;
+
+      // the shadow rays of the wave
+      shadows.clear();
+      for (int t = 0; t < args->num_threads; t++) {
+        shadows.insert(shadows.end(),thread_shadows[t].begin(),thread_shadows[t].end());
+      }
+      std::sort(shadows.begin(),shadows.end(),KeyLess<ShadowQuery>());
+      unblocked.assign(shadows.size(),0);
+      RunStage(WAVEFRONT_OCCLUDE,shadows.size());
+      for (unsigned int i = 0; i < shadows.size(); i++) {
+        if (unblocked[i]) image[shadows[i].pixel] += shadows[i].color;
+      }
+      shadow_rays_traced += shadows.size();
+
+      // the next wave is the reflected rays
+      rays.clear();
+      for (int t = 0; t < args->num_threads; t++) {
+        rays.insert(rays.end(),thread_rays[t].begin(),thread_rays[t].end());
+      }
+    }
+  }
+}
+
+// ====================================================================
+// ====================================================================
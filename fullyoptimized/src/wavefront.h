@@ -0,0 +1,114 @@
+#ifndef _WAVEFRONT_H_
+#define _WAVEFRONT_H_
+
+#include <vector>
+#include "vectors.h"
+#include "hit.h"
+
+class Mesh;
+class RayTracer;
+class ArgParser;
+
+// ====================================================================
+// a ray waiting to be cast, and what it is worth to its pixel
+
+struct WavefrontRay {
+  Vec3f origin;
+  Vec3f direction;
+  Vec3f weight;    // the ray's color is scaled by this & added to the pixel
+  int pixel;
+  int depth;       // the number of bounces before this ray
+  unsigned long long key;
+};
+
+// a shadow ray: the color is added to the pixel if nothing blocks the
+// segment from the origin to the target
+struct ShadowQuery {
+  Vec3f origin;
+  Vec3f target;
+  Vec3f color;
+  int pixel;
+  unsigned long long key;
+};
+
+// ====================================================================
+// ====================================================================
+// Renders a whole frame breadth first instead of one pixel at a time:
+// all the primary rays are cast, then all of the hits are shaded,
+// which queues their shadow rays & reflected rays, then all the shadow
+// rays are tested, and so on for the reflected rays.  Before each
+// stage the queue is sorted by origin & direction, so the rays each
+// thread handles together are close and point the same way.
+//
+// The direct light is estimated with num_shadow_samples points on each
+// light (from the sample sequence), so the noise differs a little from
+// RayTracer::TraceRay, which starts from the corners of each light.
+
+class WavefrontRenderer {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR
+  WavefrontRenderer(Mesh *m, RayTracer *r, ArgParser *a) {
+    mesh = m;
+    raytracer = r;
+    args = a;
+    width = height = 0;
+    rays_traced = 0;
+    shadow_rays_traced = 0;
+  }
+
+  // trace the frame (uses args->num_threads threads)
+  void Render();
+
+  // =========
+  // ACCESSORS
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  Vec3f getColor(int x, int y) const { return image[y*width+x]; }
+  long long getRaysTraced() const { return rays_traced; }
+  long long getShadowRaysTraced() const { return shadow_rays_traced; }
+
+  // called by the worker threads, for the queue entries [first,last)
+  void Intersect(int first, int last);
+  void Shade(int first, int last, int thread);
+  void Occlude(int first, int last);
+
+private:
+
+  // HELPER FUNCTIONS
+  void GeneratePrimaryRays();
+  void RunStage(int stage, int n);
+  unsigned long long SortKey(const Vec3f &origin, const Vec3f &direction) const;
+
+  // ==============
+  // REPRESENTATION
+  Mesh *mesh;
+  RayTracer *raytracer;
+  ArgParser *args;
+  int width, height;
+  std::vector<Vec3f> image;
+  // the scene's bounding box, for the sort keys
+  Vec3f scene_min, scene_size;
+
+  // the current wave of rays, their hits & the light they pick up
+  // right away (emission, background & indirect light)
+  std::vector<WavefrontRay> rays;
+  std::vector<Hit> hits;
+  std::vector<Vec3f> ray_colors;
+  // the queues each thread fills while shading
+  std::vector<std::vector<ShadowQuery> > thread_shadows;
+  std::vector<std::vector<WavefrontRay> > thread_rays;
+  // all the shadow rays of the wave & whether each one got through
+  std::vector<ShadowQuery> shadows;
+  std::vector<char> unblocked;
+
+  long long rays_traced;
+  long long shadow_rays_traced;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif